@@ -0,0 +1,172 @@
+/*
+ * Pipeline benchmark
+ *
+ * A source thread feeds numbers through a chain of stage threads to a sink
+ * thread. The stages are connected either by unbuffered channels, by buffered
+ * channels, or by queue_t's which the receiving stage polls, yielding while
+ * empty. Reports the time per message through the whole pipeline and the CPU
+ * time used, first with a source producing as fast as it can, then with a
+ * source sleeping after every burst of messages, during which stages waiting
+ * on channels block while polling stages keep spinning.
+ *
+ * Usage: bench_chan.x [stages] [messages]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <queue.h>
+#include <uthread.h>
+
+#define DEFAULT_STAGES 8
+#define DEFAULT_MESSAGES 200000
+#define BUFFERED_CAPACITY 64
+#define BURST 100 // messages sent between two sleeps of a paced source
+#define PAUSE_NS 1000000
+
+enum link_kind { LINK_UNBUFFERED, LINK_BUFFERED, LINK_QUEUE };
+
+static const char *link_names[] = {"unbuffered chan", "buffered chan", "queue + yield"};
+
+static enum link_kind kind;
+static int nr_stages;
+static long nr_messages;
+static int paced;
+static long sink_sum;
+
+/* Links between the threads, link i going into thread i (the sink is last) */
+static uthread_chan_t *chans;
+static queue_t *queues;
+static int next_stage;
+
+static double clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Messages are positive, 0 ends the stream */
+static void link_send(int link, long msg)
+{
+	if (kind == LINK_QUEUE) {
+		queue_enqueue(queues[link], (void *)(intptr_t)(msg + 1));
+	} else if (msg) {
+		uthread_chan_send(chans[link], &msg);
+	} else {
+		uthread_chan_close(chans[link]);
+	}
+}
+
+static long link_recv(int link)
+{
+	long msg;
+
+	if (kind == LINK_QUEUE) {
+		void *data;
+
+		while (queue_dequeue(queues[link], &data) == -1)
+			uthread_yield();
+		return (intptr_t)data - 1;
+	}
+	return uthread_chan_recv(chans[link], &msg) == 0 ? msg : 0;
+}
+
+static int source(void)
+{
+	for (long i = 1; i <= nr_messages; i++) {
+		link_send(0, i);
+		if (paced && i % BURST == 0) uthread_sleep_ns(PAUSE_NS);
+	}
+	link_send(0, 0);
+	return 0;
+}
+
+static int stage(void)
+{
+	int id = next_stage++;
+	long msg;
+
+	do {
+		msg = link_recv(id);
+		link_send(id + 1, msg);
+	} while (msg);
+	return 0;
+}
+
+static int sink(void)
+{
+	long msg;
+
+	while ((msg = link_recv(nr_stages)))
+		sink_sum += msg;
+	return 0;
+}
+
+static void bench_pipeline(double *ns_per_msg, double *cpu_ms)
+{
+	uthread_t *tids = malloc((nr_stages + 2) * sizeof(*tids));
+	double start, cpu_start;
+
+	uthread_start(0);
+	for (int i = 0; i <= nr_stages; i++) {
+		if (kind == LINK_QUEUE) queues[i] = queue_create();
+		else chans[i] = uthread_chan_create(sizeof(long), kind == LINK_BUFFERED ? BUFFERED_CAPACITY : 0);
+	}
+	next_stage = 0;
+	sink_sum = 0;
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	tids[0] = uthread_create(source);
+	for (int i = 0; i < nr_stages; i++)
+		tids[i + 1] = uthread_create(stage);
+	tids[nr_stages + 1] = uthread_create(sink);
+	for (int i = 0; i < nr_stages + 2; i++)
+		uthread_join(tids[i], NULL);
+	*ns_per_msg = (clock_ns(CLOCK_MONOTONIC) - start) / nr_messages;
+	*cpu_ms = (clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e6;
+
+	for (int i = 0; i <= nr_stages; i++) {
+		if (kind == LINK_QUEUE) queue_destroy(queues[i]);
+		else uthread_chan_destroy(chans[i]);
+	}
+	uthread_stop();
+	free(tids);
+
+	if (sink_sum != nr_messages * (nr_messages + 1) / 2) {
+		fprintf(stderr, "%s: wrong sum %ld\n", link_names[kind], sink_sum);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	nr_stages = argc > 1 ? atoi(argv[1]) : DEFAULT_STAGES;
+	nr_messages = argc > 2 ? atol(argv[2]) : DEFAULT_MESSAGES;
+	chans = malloc((nr_stages + 1) * sizeof(*chans));
+	queues = malloc((nr_stages + 1) * sizeof(*queues));
+	if (nr_stages <= 0 || nr_messages <= 0 || chans == NULL || queues == NULL) {
+		fprintf(stderr, "usage: %s [stages] [messages]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d stages, %ld messages\n", nr_stages, nr_messages);
+	printf("%-8s %-16s %12s %10s\n", "source", "links", "ns/msg", "cpu ms");
+	for (paced = 0; paced <= 1; paced++) {
+		for (kind = LINK_UNBUFFERED; kind <= LINK_QUEUE; kind++) {
+			double ns_per_msg, cpu_ms;
+
+			bench_pipeline(&ns_per_msg, &cpu_ms);
+			printf("%-8s %-16s %12.1f %10.1f\n", paced ? "paced" : "eager",
+			       link_names[kind], ns_per_msg, cpu_ms);
+		}
+	}
+	free(queues);
+	free(chans);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Context switch benchmark
+ *
+ * Measures the cost of a context switch with the raw ucontext primitive
+ * (swapcontext(), which the portable backend relies on) side by side with the
+ * backend libuthread was built with, and then the cost of a full
+ * uthread_yield() on top of it.
+ *
+ * Build with `make CTX=asm` (default on x86-64) or `make CTX=ucontext` to pick
+ * the library backend.
+ *
+ * Usage: bench_context.x [switches]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <private.h>
+#include <uthread.h>
+
+#define DEFAULT_SWITCHES 1000000
+#define PINGPONG_STACK_SIZE 32768
+
+static long switches_left;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* swapcontext() ping-pong between main and a single context */
+static ucontext_t uc_main, uc_thr;
+
+static void uc_pingpong(void)
+{
+	for (;;)
+		swapcontext(&uc_thr, &uc_main);
+}
+
+static double bench_ucontext(long switches)
+{
+	void *stack = malloc(PINGPONG_STACK_SIZE);
+	double start, end;
+
+	getcontext(&uc_thr);
+	uc_thr.uc_stack.ss_sp = stack;
+	uc_thr.uc_stack.ss_size = PINGPONG_STACK_SIZE;
+	makecontext(&uc_thr, uc_pingpong, 0);
+
+	start = now_ns();
+	for (long i = 0; i < switches / 2; i++)
+		swapcontext(&uc_main, &uc_thr);
+	end = now_ns();
+
+	free(stack);
+	return (end - start) / switches;
+}
+
+/* uthread_ctx_switch() ping-pong between main and a single context */
+static uthread_ctx_t ctx_main, ctx_thr;
+
+static int ctx_pingpong(void)
+{
+	for (;;)
+		uthread_ctx_switch(&ctx_thr, &ctx_main);
+	return 0;
+}
+
+static double bench_backend(long switches)
+{
+	uthread_stack_t stack;
+	double start, end;
+
+	uthread_ctx_alloc_stack(&stack, UTHREAD_STACK_SIZE, 0, UTHREAD_GUARD_SIZE);
+	uthread_ctx_init(&ctx_thr, &stack, ctx_pingpong);
+
+	start = now_ns();
+	for (long i = 0; i < switches / 2; i++)
+		uthread_ctx_switch(&ctx_main, &ctx_thr);
+	end = now_ns();
+
+	uthread_ctx_destroy_stack(&stack);
+	return (end - start) / switches;
+}
+
+static int yield_thread(void)
+{
+	while (switches_left-- > 0)
+		uthread_yield();
+	return 0;
+}
+
+static double bench_uthread_yield(long switches)
+{
+	uthread_t tid[2];
+	double start, end;
+
+	uthread_start(0);
+	switches_left = switches;
+	tid[0] = uthread_create(yield_thread);
+	tid[1] = uthread_create(yield_thread);
+	start = now_ns();
+	uthread_join(tid[0], NULL);
+	uthread_join(tid[1], NULL);
+	end = now_ns();
+	uthread_stop();
+
+	return (end - start) / switches;
+}
+
+int main(int argc, char *argv[])
+{
+	long switches = argc > 1 ? atol(argv[1]) : DEFAULT_SWITCHES;
+
+	if (switches <= 0) {
+		fprintf(stderr, "usage: %s [switches]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-32s %12s\n", "switch", "ns/switch");
+	printf("%-32s %12.1f\n", "swapcontext()",
+	       bench_ucontext(switches));
+	printf("%-32s %12.1f\n", "uthread_ctx_switch() (" UTHREAD_CTX_BACKEND ")",
+	       bench_backend(switches));
+	printf("%-32s %12.1f\n", "uthread_yield() (" UTHREAD_CTX_BACKEND ")",
+	       bench_uthread_yield(switches));
+
+	return 0;
+}
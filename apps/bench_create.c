@@ -0,0 +1,105 @@
+/*
+ * Thread create/join churn benchmark
+ *
+ * Repeatedly creates a batch of threads and joins all of them, which is the
+ * pattern that stresses stack allocation the most. Reports the create+join
+ * throughput and the peak resident set size of the process.
+ *
+ * The stack and guard sizes of the threads can be customized, e.g. to check
+ * that 100k threads with 1 MiB stacks only cost the memory they touch:
+ * `bench_create.x 100000 1 1048576 0`
+ *
+ * With a non-zero last argument, the threads are created detached and never
+ * joined, the main thread yielding after each batch until the batch has run:
+ * the peak resident set size must then not grow with the number of rounds.
+ *
+ * Usage: bench_create.x [batch size] [rounds] [stack size] [guard size]
+ *	[detached]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_BATCH 1000
+#define DEFAULT_ROUNDS 200
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long nr_done;
+
+/* Touch a bit of stack, like a real thread would */
+static int worker(void)
+{
+	volatile char buf[2048];
+
+	buf[0] = buf[sizeof(buf) - 1] = 1;
+	nr_done++;
+	return buf[0];
+}
+
+int main(int argc, char *argv[])
+{
+	int batch = argc > 1 ? atoi(argv[1]) : DEFAULT_BATCH;
+	int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+	uthread_attr_t attr;
+	uthread_t *tids;
+	struct rusage ru;
+	double start, end;
+
+	uthread_attr_init(&attr);
+	if (argc > 3)
+		attr.stack_size = atol(argv[3]);
+	if (argc > 4)
+		attr.guard_size = atol(argv[4]);
+	if (argc > 5)
+		attr.detached = atoi(argv[5]) != 0;
+
+	if (batch <= 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [batch size] [rounds] [stack size] "
+			"[guard size] [detached]\n", argv[0]);
+		return 1;
+	}
+	tids = malloc(batch * sizeof(*tids));
+
+	uthread_start(0);
+	start = now_ns();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < batch; i++)
+			tids[i] = uthread_create_attr(worker, &attr);
+		if (attr.detached) {
+			while (nr_done < (long)batch * (r + 1))
+				uthread_yield();
+			continue;
+		}
+		for (int i = 0; i < batch; i++)
+			uthread_join(tids[i], NULL);
+	}
+	end = now_ns();
+	uthread_stop();
+
+	if (tids[0] == (uthread_t)-1) {
+		fprintf(stderr, "thread creation failed\n");
+		return 1;
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("threads: %ld\n", (long)batch * rounds);
+	printf("%s: %.1f ns/thread, %.0f threads/s\n",
+	       attr.detached ? "create detached" : "create+join",
+	       (end - start) / ((double)batch * rounds),
+	       (double)batch * rounds * 1e9 / (end - start));
+	printf("max rss: %ld KiB\n", ru.ru_maxrss);
+
+	free(tids);
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Work-stealing deque benchmark
+ *
+ * Compares the lock-free Chase-Lev deque against a queue_t protected by a
+ * mutex, used as a per-worker run queue: an owner thread produces items in
+ * bursts and consumes part of them itself, while 1 to 64 thief threads
+ * concurrently take the rest. Reports the time to get every item consumed and
+ * the share of the items that thieves got.
+ *
+ * Usage: bench_deque.x [items] [max thieves]
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <deque.h>
+#include <queue.h>
+
+#define DEFAULT_ITEMS 2000000
+#define DEFAULT_MAX_THIEVES 64
+#define BURST 64 // items pushed by the owner before popping half of them
+
+struct container {
+	const char *name;
+	void *(*create)(void);
+	void (*destroy)(void *c);
+	int (*push)(void *c, void *data); // owner
+	int (*pop)(void *c, void **data); // owner
+	int (*steal)(void *c, void **data); // thieves
+};
+
+/* Lock-free deque */
+static void *lf_create(void) { return deque_create(); }
+static void lf_destroy(void *c) { deque_destroy(c); }
+static int lf_push(void *c, void *data) { return deque_push(c, data); }
+static int lf_pop(void *c, void **data) { return deque_pop(c, data); }
+static int lf_steal(void *c, void **data) { return deque_steal(c, data); }
+
+/* Mutex-wrapped queue */
+struct locked_queue {
+	pthread_mutex_t lock;
+	queue_t queue;
+};
+
+static void *lq_create(void)
+{
+	struct locked_queue *lq = malloc(sizeof(*lq));
+
+	pthread_mutex_init(&lq->lock, NULL);
+	lq->queue = queue_create();
+	return lq;
+}
+
+static void lq_destroy(void *c)
+{
+	struct locked_queue *lq = c;
+
+	queue_destroy(lq->queue);
+	pthread_mutex_destroy(&lq->lock);
+	free(lq);
+}
+
+static int lq_push(void *c, void *data)
+{
+	struct locked_queue *lq = c;
+	int ret;
+
+	pthread_mutex_lock(&lq->lock);
+	ret = queue_enqueue(lq->queue, data);
+	pthread_mutex_unlock(&lq->lock);
+	return ret;
+}
+
+static int lq_take(void *c, void **data)
+{
+	struct locked_queue *lq = c;
+	int ret;
+
+	pthread_mutex_lock(&lq->lock);
+	ret = queue_dequeue(lq->queue, data);
+	pthread_mutex_unlock(&lq->lock);
+	return ret;
+}
+
+static const struct container containers[] = {
+	{"mutex+queue_t", lq_create, lq_destroy, lq_push, lq_take, lq_take},
+	{"chase-lev", lf_create, lf_destroy, lf_push, lf_pop, lf_steal},
+};
+
+static const struct container *bench_container;
+static void *bench_c;
+static long bench_items;
+static atomic_long consumed;
+static atomic_long stolen;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *thief(void *arg)
+{
+	long mine = 0;
+	void *data;
+	(void)arg;
+
+	while (atomic_load_explicit(&consumed, memory_order_relaxed) < bench_items) {
+		if (bench_container->steal(bench_c, &data) == 0) {
+			mine++;
+			atomic_fetch_add_explicit(&consumed, 1, memory_order_relaxed);
+		}
+	}
+	atomic_fetch_add(&stolen, mine);
+
+	return NULL;
+}
+
+static double bench_run(const struct container *container, int nr_thieves,
+			double *stolen_share)
+{
+	pthread_t *thieves = malloc(nr_thieves * sizeof(*thieves));
+	static char item; // items are never dereferenced
+	double start, end;
+	void *data;
+
+	bench_container = container;
+	bench_c = container->create();
+	atomic_store(&consumed, 0);
+	atomic_store(&stolen, 0);
+
+	start = now_ns();
+	for (int i = 0; i < nr_thieves; i++)
+		pthread_create(&thieves[i], NULL, thief, NULL);
+
+	for (long pushed = 0; pushed < bench_items;) {
+		for (int i = 0; i < BURST && pushed < bench_items; i++, pushed++)
+			container->push(bench_c, &item);
+		for (int i = 0; i < BURST / 2; i++) {
+			if (container->pop(bench_c, &data) == 0)
+				atomic_fetch_add_explicit(&consumed, 1, memory_order_relaxed);
+		}
+	}
+	while (container->pop(bench_c, &data) == 0)
+		atomic_fetch_add_explicit(&consumed, 1, memory_order_relaxed);
+
+	for (int i = 0; i < nr_thieves; i++)
+		pthread_join(thieves[i], NULL);
+	end = now_ns();
+
+	container->destroy(bench_c);
+	free(thieves);
+
+	*stolen_share = (double)atomic_load(&stolen) / bench_items;
+	return (end - start) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_thieves = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THIEVES;
+
+	bench_items = argc > 1 ? atol(argv[1]) : DEFAULT_ITEMS;
+	if (bench_items <= 0 || max_thieves <= 0) {
+		fprintf(stderr, "usage: %s [items] [max thieves]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-8s %-14s %10s %12s %8s\n", "thieves", "container", "time ms",
+	       "Mitems/s", "stolen");
+	for (int n = 1; n <= max_thieves; n *= 2) {
+		for (size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); i++) {
+			double share;
+			double ms = bench_run(&containers[i], n, &share);
+
+			printf("%-8d %-14s %10.1f %12.2f %7.1f%%\n", n,
+			       containers[i].name, ms, bench_items / ms / 1e3,
+			       share * 100);
+		}
+	}
+
+	return 0;
+}
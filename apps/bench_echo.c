@@ -0,0 +1,235 @@
+/*
+ * Echo server benchmark
+ *
+ * A TCP echo server on the loopback interface runs one thread per connection,
+ * and as many client threads connect to it and bounce small messages off it.
+ * Every thread uses the library's non-blocking I/O, so that the whole process
+ * multiplexes tens of thousands of connections with a handful of kernel
+ * threads. Reports the number of round trips per second.
+ *
+ * Usage: bench_echo.x [connections] [round trips] [workers]
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_CONNS 10000
+#define DEFAULT_ROUNDS 100
+#define DEFAULT_WORKERS 1
+#define MSG_SIZE 64
+#define SPARE_FDS 16 // descriptors left for the library and stdio
+
+static int nr_conns, nr_rounds;
+static int listen_fd;
+static struct sockaddr_in server_addr;
+static int *conn_fds; // accepted connections, in order
+static atomic_int nr_handlers; // connections claimed by a handler
+static atomic_int nr_clients; // clients started
+static atomic_long nr_round_trips;
+static atomic_int nr_errors;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Read exactly @count bytes, unless the peer closes the connection first */
+static ssize_t read_full(int fd, char *buf, size_t count)
+{
+	size_t done = 0;
+
+	while (done < count) {
+		ssize_t n = uthread_read(fd, buf + done, count - done);
+		if (n <= 0) return n;
+		done += n;
+	}
+	return done;
+}
+
+static ssize_t write_full(int fd, const char *buf, size_t count)
+{
+	size_t done = 0;
+
+	while (done < count) {
+		ssize_t n = uthread_write(fd, buf + done, count - done);
+		if (n < 0) return n;
+		done += n;
+	}
+	return done;
+}
+
+/* Echoes everything back until the client closes the connection */
+static int handler(void)
+{
+	int fd = conn_fds[atomic_fetch_add(&nr_handlers, 1)];
+	char buf[MSG_SIZE];
+	ssize_t n;
+
+	while ((n = uthread_read(fd, buf, sizeof(buf))) > 0) {
+		if (write_full(fd, buf, n) < 0) break;
+	}
+	if (n < 0) atomic_fetch_add(&nr_errors, 1);
+	uthread_close(fd);
+
+	return 0;
+}
+
+/* Accepts every client's connection, and collects their handlers */
+static int acceptor(void)
+{
+	uthread_t *handlers = malloc(nr_conns * sizeof(*handlers));
+	int nr_accepted = 0;
+
+	for (int i = 0; i < nr_conns; i++) {
+		int fd = uthread_accept(listen_fd, NULL, NULL);
+		int one = 1;
+
+		if (fd < 0) {
+			atomic_fetch_add(&nr_errors, 1);
+			break;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		conn_fds[i] = fd; // before its handler gets to run
+		handlers[nr_accepted++] = uthread_create(handler);
+	}
+
+	// Handlers exit once their client closes its end of the connection
+	for (int i = 0; i < nr_accepted; i++)
+		uthread_join(handlers[i], NULL);
+	free(handlers);
+
+	return 0;
+}
+
+static int client(void)
+{
+	char msg[MSG_SIZE], reply[MSG_SIZE];
+	int id = atomic_fetch_add(&nr_clients, 1);
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int one = 1;
+
+	if (fd < 0 || uthread_connect(fd, (struct sockaddr *)&server_addr,
+				      sizeof(server_addr)) < 0) {
+		atomic_fetch_add(&nr_errors, 1);
+		if (fd >= 0) uthread_close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	memset(msg, id, sizeof(msg));
+	for (int i = 0; i < nr_rounds; i++) {
+		if (write_full(fd, msg, sizeof(msg)) < 0
+		    || read_full(fd, reply, sizeof(reply)) != sizeof(reply)
+		    || memcmp(msg, reply, sizeof(msg))) {
+			atomic_fetch_add(&nr_errors, 1);
+			break;
+		}
+		atomic_fetch_add_explicit(&nr_round_trips, 1, memory_order_relaxed);
+	}
+	uthread_close(fd);
+
+	return 0;
+}
+
+/* Allow as many descriptors as possible, and return how many connections fit */
+static int max_conns(void)
+{
+	struct rlimit lim;
+
+	if (getrlimit(RLIMIT_NOFILE, &lim) == -1) return 0;
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+	getrlimit(RLIMIT_NOFILE, &lim);
+
+	return (lim.rlim_cur - SPARE_FDS) / 2; // a client and a server end each
+}
+
+static int listen_loopback(void)
+{
+	socklen_t len = sizeof(server_addr);
+	int one = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listen_fd < 0) return -1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server_addr.sin_port = 0; // any free port
+	if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0
+	    || listen(listen_fd, SOMAXCONN) < 0
+	    || getsockname(listen_fd, (struct sockaddr *)&server_addr, &len) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int limit = max_conns();
+	int workers = argc > 3 ? atoi(argv[3]) : DEFAULT_WORKERS;
+	uthread_opts_t opts;
+	uthread_t server, *clients;
+	double start, ms;
+
+	nr_conns = argc > 1 ? atoi(argv[1]) : DEFAULT_CONNS;
+	nr_rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+	if (nr_conns <= 0 || nr_rounds <= 0 || workers <= 0) {
+		fprintf(stderr, "usage: %s [connections] [round trips] [workers]\n", argv[0]);
+		return 1;
+	}
+	if (nr_conns > limit) {
+		fprintf(stderr, "%d connections exceed the descriptor limit, using %d\n",
+			nr_conns, limit);
+		nr_conns = limit;
+	}
+	conn_fds = malloc(nr_conns * sizeof(*conn_fds));
+	clients = malloc(nr_conns * sizeof(*clients));
+	if (conn_fds == NULL || clients == NULL || listen_loopback() == -1) {
+		perror("setup");
+		return 1;
+	}
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = workers;
+	if (uthread_start_opts(&opts) == -1) {
+		fprintf(stderr, "uthread_start_opts failed\n");
+		return 1;
+	}
+
+	start = now_ns();
+	server = uthread_create(acceptor);
+	for (int i = 0; i < nr_conns; i++)
+		clients[i] = uthread_create(client);
+	for (int i = 0; i < nr_conns; i++)
+		uthread_join(clients[i], NULL);
+	ms = (now_ns() - start) / 1e6;
+
+	uthread_join(server, NULL);
+	uthread_close(listen_fd);
+	uthread_stop();
+
+	printf("%d connections, %d round trips each, %d workers\n", nr_conns,
+	       nr_rounds, workers);
+	printf("%ld round trips in %.1f ms: %.0f round trips/s, %d errors\n",
+	       atomic_load(&nr_round_trips), ms,
+	       atomic_load(&nr_round_trips) / ms * 1e3, atomic_load(&nr_errors));
+	free(clients);
+	free(conn_fds);
+
+	return atomic_load(&nr_errors) != 0;
+}
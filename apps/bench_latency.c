@@ -0,0 +1,123 @@
+/*
+ * Preemption latency benchmark
+ *
+ * An interactive thread competes with CPU hogs which never yield. Requests
+ * become due at random times, and the interactive thread polls for them
+ * (yielding between polls), so that the delay between a request becoming due
+ * and the interactive thread noticing it is the scheduling latency: the time
+ * it takes for the hogs to be preempted. The p50/p99/max response latencies
+ * are reported for time slices from 100 us to 10 ms of CLOCK_MONOTONIC.
+ *
+ * Usage: bench_latency.x [hogs] [ms per quantum]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_HOGS 3
+#define DEFAULT_MS 1000
+#define MAX_DELAY_US 2000 // requests are due within 0-2 ms of each other
+#define MAX_SAMPLES 100000
+
+static const unsigned int quanta[] = {100, 250, 500, 1000, 2500, 5000, 10000};
+
+static volatile int stop;
+static double duration_ns;
+static double samples[MAX_SAMPLES];
+static int nr_samples;
+static volatile long hog_loops;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int hog(void)
+{
+	while (!stop)
+		hog_loops++;
+	return 0;
+}
+
+static int interactive(void)
+{
+	double start = now_ns(), now = start;
+
+	while (now - start < duration_ns && nr_samples < MAX_SAMPLES) {
+		double due = now + (rand() % MAX_DELAY_US) * 1e3;
+
+		while ((now = now_ns()) < due)
+			uthread_yield();
+		samples[nr_samples++] = now - due;
+	}
+	stop = 1;
+
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(double p)
+{
+	return samples[(int)(p * (nr_samples - 1))];
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_hogs = argc > 1 ? atoi(argv[1]) : DEFAULT_HOGS;
+	int ms = argc > 2 ? atoi(argv[2]) : DEFAULT_MS;
+	uthread_t *hogs = malloc(nr_hogs * sizeof(*hogs));
+
+	if (nr_hogs < 0 || ms <= 0 || hogs == NULL) {
+		fprintf(stderr, "usage: %s [hogs] [ms per quantum]\n", argv[0]);
+		return 1;
+	}
+	duration_ns = ms * 1e6;
+
+	printf("%d hogs, %d ms per quantum\n", nr_hogs, ms);
+	printf("%-12s %8s %12s %12s %12s\n", "quantum us", "samples", "p50 us",
+	       "p99 us", "max us");
+	for (size_t q = 0; q < sizeof(quanta) / sizeof(quanta[0]); q++) {
+		uthread_opts_t opts;
+		uthread_t tid;
+
+		uthread_opts_init(&opts);
+		opts.preempt = UTHREAD_PREEMPT_ASYNC;
+		opts.quantum_us = quanta[q];
+		opts.clock = CLOCK_MONOTONIC;
+		if (uthread_start_opts(&opts) == -1) {
+			fprintf(stderr, "uthread_start_opts failed\n");
+			return 1;
+		}
+
+		stop = 0;
+		nr_samples = 0;
+		srand(1);
+		for (int i = 0; i < nr_hogs; i++)
+			hogs[i] = uthread_create(hog);
+		tid = uthread_create(interactive);
+		uthread_join(tid, NULL);
+		for (int i = 0; i < nr_hogs; i++)
+			uthread_join(hogs[i], NULL);
+		uthread_stop();
+
+		qsort(samples, nr_samples, sizeof(samples[0]), cmp_double);
+		printf("%-12u %8d %12.1f %12.1f %12.1f\n", quanta[q], nr_samples,
+		       percentile(0.5) / 1e3, percentile(0.99) / 1e3,
+		       samples[nr_samples - 1] / 1e3);
+	}
+	free(hogs);
+
+	return 0;
+}
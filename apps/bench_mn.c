@@ -0,0 +1,95 @@
+/*
+ * M:N scaling benchmark
+ *
+ * CPU-bound fan-out: the main thread creates many threads which each crunch
+ * numbers (yielding from time to time) and joins all of them. The same
+ * workload is run with 1, 2, 4, ... workers up to the given maximum, and the
+ * speedup over a single worker is reported.
+ *
+ * Usage: bench_mn.x [max workers] [threads] [iterations per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uthread.h>
+
+#define DEFAULT_THREADS 256
+#define DEFAULT_ITERS 2000000
+#define YIELD_EVERY 100000
+
+static long iters;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cruncher(void)
+{
+	volatile unsigned long acc = 0;
+
+	for (long i = 0; i < iters; i++) {
+		acc += i * i ^ (acc >> 3);
+		if (i % YIELD_EVERY == 0) uthread_yield();
+	}
+	return 0;
+}
+
+static double bench_fanout(int nr_workers, int nr_thrs)
+{
+	uthread_opts_t opts;
+	uthread_t *tids = malloc(nr_thrs * sizeof(*tids));
+	double start, end;
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = nr_workers;
+	if (tids == NULL || uthread_start_opts(&opts) == -1) {
+		fprintf(stderr, "uthread_start_opts failed\n");
+		exit(1);
+	}
+
+	start = now_ns();
+	for (int i = 0; i < nr_thrs; i++)
+		tids[i] = uthread_create(cruncher);
+	for (int i = 0; i < nr_thrs; i++)
+		uthread_join(tids[i], NULL);
+	end = now_ns();
+
+	uthread_stop();
+	free(tids);
+
+	return (end - start) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_workers = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int nr_thrs = argc > 2 ? atoi(argv[2]) : DEFAULT_THREADS;
+	double base = 0;
+
+	iters = argc > 3 ? atol(argv[3]) : DEFAULT_ITERS;
+	if (max_workers <= 0 || nr_thrs <= 0 || iters <= 0) {
+		fprintf(stderr, "usage: %s [max workers] [threads] [iterations]\n",
+			argv[0]);
+		return 1;
+	}
+
+	printf("%d threads x %ld iterations, %ld online CPUs\n", nr_thrs, iters,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-8s %12s %10s\n", "workers", "time ms", "speedup");
+	for (int n = 1;; n = n * 2 < max_workers ? n * 2 : max_workers) {
+		double ms = bench_fanout(n, nr_thrs);
+
+		if (n == 1) base = ms;
+		printf("%-8d %12.1f %10.2f\n", n, ms, base / ms);
+		if (n == max_workers) break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * Queue benchmark
+ *
+ * Times the operations of the queue API at queue sizes from 10 up to 10M. This
+ * program is linked once against each queue implementation of the library
+ * (bench_queue_list.x and bench_queue_ring.x), and both print the same table
+ * so that their results can be compared side by side.
+ *
+ * Besides each operation on its own, the "mixed" workload replays the way the
+ * scheduler uses a run queue: a full queue is rotated (dequeue then enqueue),
+ * with the occasional deletion of an item (a thread blocking), enqueued back
+ * once the rotation comes around to it (waking up), and iteration looking for
+ * one. Deletions and searches pick items among the first DELETE_MAX_SIZE of the
+ * queue, so that their O(n) cost stays bounded on the largest queues.
+ *
+ * Along with the time, the user-space CPU cycles, instructions, cache misses
+ * and branch mispredictions per operation are read from the hardware counters
+ * with perf_event_open(2). Counters which the kernel or the machine (e.g. a
+ * virtual machine without a virtual PMU) does not provide are shown as "-".
+ *
+ * Usage: bench_queue_<impl>.x [max size]
+ */
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <queue.h>
+
+#ifndef QUEUE_IMPL
+#define QUEUE_IMPL "libuthread"
+#endif
+
+#define DEFAULT_MAX_SIZE 10000000
+
+/* Deletions are O(n), so they run on a bounded queue size */
+#define DELETE_MAX_SIZE 10000
+#define NR_DELETES 1000
+
+/* Mixed workload: one deletion and one search every MIXED_RARE operations */
+#define NR_MIXED 100000
+#define MIXED_RARE 64
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} hw_events[] = {
+	{"cycles", PERF_COUNT_HW_CPU_CYCLES},
+	{"instrs", PERF_COUNT_HW_INSTRUCTIONS},
+	{"cmisses", PERF_COUNT_HW_CACHE_MISSES},
+	{"bmisses", PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+#define NR_EVENTS (sizeof(hw_events) / sizeof(hw_events[0]))
+
+/* Counters, opened as a group so that they count over the same intervals */
+static int event_fds[NR_EVENTS];
+static int leader = -1;
+
+struct measure {
+	double start;
+	double ns;
+	double counts[NR_EVENTS]; // -1 if unavailable
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void counters_open(void)
+{
+	for (size_t i = 0; i < NR_EVENTS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = hw_events[i].config;
+		attr.disabled = leader == -1; // the group is enabled by its leader
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		event_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+		if (event_fds[i] == -1) {
+			fprintf(stderr, "%s: counter unavailable: %s\n",
+				hw_events[i].name, strerror(errno));
+		} else if (leader == -1) {
+			leader = event_fds[i];
+		}
+	}
+}
+
+static void counters_close(void)
+{
+	for (size_t i = 0; i < NR_EVENTS; i++) {
+		if (event_fds[i] != -1)
+			close(event_fds[i]);
+	}
+}
+
+static void measure_start(struct measure *m)
+{
+	if (leader != -1) {
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	m->start = now_ns();
+}
+
+static void measure_stop(struct measure *m)
+{
+	m->ns = now_ns() - m->start;
+	if (leader != -1)
+		ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	for (size_t i = 0; i < NR_EVENTS; i++) {
+		uint64_t val[3]; // value, time enabled, time running
+
+		m->counts[i] = -1;
+		if (event_fds[i] == -1 || read(event_fds[i], val, sizeof(val)) != sizeof(val))
+			continue;
+		// Scale up counts the kernel had to multiplex with other events
+		m->counts[i] = val[2] ? (double)val[0] * val[1] / val[2] : 0;
+	}
+}
+
+static void report(const char *op, long size, const struct measure *m, long ops)
+{
+	printf("%-8s %-10s %10ld %12.2f", QUEUE_IMPL, op, size, m->ns / ops);
+	for (size_t i = 0; i < NR_EVENTS; i++) {
+		if (m->counts[i] < 0)
+			printf(" %10s", "-");
+		else
+			printf(" %10.2f", m->counts[i] / ops);
+	}
+	printf("\n");
+}
+
+static int sum_item(queue_t q, void *data, void *arg)
+{
+	(void)q;
+	*(long *)arg += *(int *)data;
+	return 0;
+}
+
+static int find_item(queue_t q, void *data, void *arg)
+{
+	(void)q;
+	return data == arg;
+}
+
+/* Index of the first item from @i on which is in the queue */
+static long unparked(const char *parked, long size, long i)
+{
+	while (parked[i % size])
+		i++;
+	return i % size;
+}
+
+/*
+ * Rotate a queue of @size items, deleting some of them for a while and looking
+ * up others. The queue holds the items which are not parked in the order of
+ * their indices, starting from @head.
+ */
+static void bench_mixed(int *items, long size)
+{
+	long depth = size < DELETE_MAX_SIZE ? size : DELETE_MAX_SIZE;
+	queue_t q = queue_create();
+	int *offsets = malloc(NR_MIXED * sizeof(*offsets));
+	char *parked = calloc(size, 1);
+	long head = 0, i;
+	struct measure m;
+	void *ptr;
+
+	// Draw the positions of the items to delete or look up beforehand, out of
+	// the counts
+	srand(size);
+	for (i = 0; i < NR_MIXED; i++)
+		offsets[i] = rand() % depth;
+	for (i = 0; i < size; i++)
+		queue_enqueue(q, &items[i]);
+
+	measure_start(&m);
+	for (i = 0; i < NR_MIXED; i++) {
+		if (i % MIXED_RARE == 0) {
+			long del = unparked(parked, size, head + offsets[i]);
+
+			if (del != head) { // keep the queue from running empty
+				queue_delete(q, &items[del]);
+				parked[del] = 1;
+			}
+		} else if (i % MIXED_RARE == MIXED_RARE / 2) {
+			long find = unparked(parked, size, head + offsets[i]);
+
+			queue_iterate(q, find_item, &items[find], &ptr);
+		} else {
+			queue_dequeue(q, &ptr);
+			queue_enqueue(q, ptr);
+			// Parked items come back right after their predecessor
+			head = (head + 1) % size;
+			while (parked[head]) {
+				queue_enqueue(q, &items[head]);
+				parked[head] = 0;
+				head = (head + 1) % size;
+			}
+		}
+	}
+	measure_stop(&m);
+	report("mixed", size, &m, NR_MIXED);
+
+	while (queue_dequeue(q, &ptr) == 0)
+		;
+	queue_destroy(q);
+	free(parked);
+	free(offsets);
+}
+
+static void bench_size(int *items, long size)
+{
+	queue_t q = queue_create();
+	struct measure m;
+	long sum = 0;
+	void *ptr;
+
+	measure_start(&m);
+	for (long i = 0; i < size; i++)
+		queue_enqueue(q, &items[i]);
+	measure_stop(&m);
+	report("enqueue", size, &m, size);
+
+	measure_start(&m);
+	queue_iterate(q, sum_item, &sum, NULL);
+	measure_stop(&m);
+	report("iterate", size, &m, size);
+
+	measure_start(&m);
+	for (long i = 0; i < size; i++)
+		queue_dequeue(q, &ptr);
+	measure_stop(&m);
+	report("dequeue", size, &m, size);
+
+	/* Delete random items out of a full queue */
+	long del_size = size < DELETE_MAX_SIZE ? size : DELETE_MAX_SIZE;
+	long nr_del = del_size < NR_DELETES ? del_size : NR_DELETES;
+	for (long i = 0; i < del_size; i++)
+		queue_enqueue(q, &items[i]);
+	srand(size);
+	measure_start(&m);
+	for (long i = 0; i < nr_del; i++)
+		queue_delete(q, &items[rand() % del_size]);
+	measure_stop(&m);
+	report("delete", del_size, &m, nr_del);
+
+	while (queue_dequeue(q, &ptr) == 0)
+		;
+	queue_destroy(q);
+
+	bench_mixed(items, size);
+
+	if (sum != size) // keep the iteration from being optimized out
+		fprintf(stderr, "unexpected sum %ld\n", sum);
+}
+
+int main(int argc, char *argv[])
+{
+	long max_size = argc > 1 ? atol(argv[1]) : DEFAULT_MAX_SIZE;
+	int *items;
+
+	if (max_size <= 0) {
+		fprintf(stderr, "usage: %s [max size]\n", argv[0]);
+		return 1;
+	}
+
+	items = malloc(max_size * sizeof(*items));
+	for (long i = 0; i < max_size; i++)
+		items[i] = 1;
+	counters_open();
+
+	printf("%-8s %-10s %10s %12s", "impl", "op", "size", "ns/op");
+	for (size_t i = 0; i < NR_EVENTS; i++)
+		printf(" %10s", hw_events[i].name);
+	printf("\n");
+	for (long size = 10; size <= max_size; size *= 10)
+		bench_size(items, size);
+
+	counters_close();
+	free(items);
+	return 0;
+}
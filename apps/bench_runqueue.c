@@ -0,0 +1,198 @@
+/*
+ * Run queue benchmark
+ *
+ * Compares the context switch throughput of a round-robin scheduler whose
+ * ready queue is the node-based queue_t against the same scheduler using the
+ * intrusive queue embedded in the thread structure (as libuthread does).
+ *
+ * Each switch does exactly what uthread_yield() does: enqueue the running
+ * thread at the tail of the ready queue, dequeue the oldest thread and switch
+ * to it. The raw cost of the queue operations alone (no context switch) is
+ * reported as well, followed by the throughput of uthread_yield() itself.
+ *
+ * Usage: bench_runqueue.x [switches]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <iqueue.h>
+#include <private.h>
+#include <queue.h>
+#include <uthread.h>
+
+#define DEFAULT_SWITCHES 1000000
+
+struct bthr {
+	uthread_ctx_t ctx;
+	uthread_stack_t stack;
+	struct iqueue_node link;
+};
+
+static const int nr_thrs[] = {2, 16, 256};
+
+static queue_t list_rq;
+static struct iqueue intr_rq;
+static int use_intrusive;
+static struct bthr *bench_curr;
+static uthread_ctx_t bench_main_ctx;
+static long switches_left;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Put @thr back at the tail of the ready queue */
+static void rq_put(struct bthr *thr)
+{
+	if (use_intrusive)
+		iqueue_enqueue(&intr_rq, &thr->link);
+	else
+		queue_enqueue(list_rq, thr);
+}
+
+/* Get the oldest thread of the ready queue */
+static struct bthr *rq_get(void)
+{
+	struct bthr *thr;
+
+	if (use_intrusive)
+		return iqueue_entry(iqueue_dequeue(&intr_rq), struct bthr, link);
+
+	queue_dequeue(list_rq, (void **)&thr);
+	return thr;
+}
+
+/* Body of every benchmark thread: round-robin yield until done */
+static int bench_thread(void)
+{
+	for (;;) {
+		struct bthr *prev = bench_curr;
+
+		rq_put(prev);
+		bench_curr = rq_get();
+		if (--switches_left == 0)
+			uthread_ctx_switch(&prev->ctx, &bench_main_ctx);
+		else
+			uthread_ctx_switch(&prev->ctx, &bench_curr->ctx);
+	}
+
+	return 0;
+}
+
+static double bench_switch(int intrusive, int n, long switches)
+{
+	struct bthr *thrs = calloc(n, sizeof(*thrs));
+	double start, end;
+
+	use_intrusive = intrusive;
+	list_rq = queue_create();
+	iqueue_init(&intr_rq);
+
+	for (int i = 0; i < n; i++) {
+		uthread_ctx_alloc_stack(&thrs[i].stack, UTHREAD_STACK_SIZE, 0,
+					UTHREAD_GUARD_SIZE);
+		uthread_ctx_init(&thrs[i].ctx, &thrs[i].stack, bench_thread);
+		rq_put(&thrs[i]);
+	}
+
+	switches_left = switches;
+	start = now_ns();
+	bench_curr = rq_get();
+	uthread_ctx_switch(&bench_main_ctx, &bench_curr->ctx);
+	end = now_ns();
+
+	/* Drain the ready queue, the threads are never resumed again */
+	for (int i = 0; i < n - 1; i++)
+		rq_get();
+	queue_destroy(list_rq);
+	for (int i = 0; i < n; i++)
+		uthread_ctx_destroy_stack(&thrs[i].stack);
+	free(thrs);
+
+	return (end - start) / switches;
+}
+
+static double bench_ops(int intrusive, int n, long ops)
+{
+	struct bthr *thrs = calloc(n, sizeof(*thrs));
+	double start, end;
+
+	use_intrusive = intrusive;
+	list_rq = queue_create();
+	iqueue_init(&intr_rq);
+	for (int i = 0; i < n; i++)
+		rq_put(&thrs[i]);
+
+	start = now_ns();
+	for (long i = 0; i < ops; i++)
+		rq_put(rq_get());
+	end = now_ns();
+
+	for (int i = 0; i < n; i++)
+		rq_get();
+	queue_destroy(list_rq);
+	free(thrs);
+
+	return (end - start) / ops;
+}
+
+static long yields_left;
+
+static int yield_thread(void)
+{
+	while (yields_left-- > 0)
+		uthread_yield();
+	return 0;
+}
+
+static double bench_uthread_yield(long switches)
+{
+	uthread_t tid[2];
+	double start, end;
+
+	uthread_start(0);
+	yields_left = switches;
+	tid[0] = uthread_create(yield_thread);
+	tid[1] = uthread_create(yield_thread);
+	start = now_ns();
+	uthread_join(tid[0], NULL);
+	uthread_join(tid[1], NULL);
+	end = now_ns();
+	uthread_stop();
+
+	return (end - start) / switches;
+}
+
+int main(int argc, char *argv[])
+{
+	long switches = argc > 1 ? atol(argv[1]) : DEFAULT_SWITCHES;
+
+	if (switches <= 0) {
+		fprintf(stderr, "usage: %s [switches]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-8s %-12s %12s %12s %14s\n", "threads", "queue",
+	       "ops ns/op", "switch ns", "switches/s");
+	for (size_t i = 0; i < sizeof(nr_thrs) / sizeof(nr_thrs[0]); i++) {
+		for (int intrusive = 0; intrusive <= 1; intrusive++) {
+			double ops = bench_ops(intrusive, nr_thrs[i], switches);
+			double sw = bench_switch(intrusive, nr_thrs[i], switches);
+
+			printf("%-8d %-12s %12.1f %12.1f %14.0f\n", nr_thrs[i],
+			       intrusive ? "intrusive" : "queue_t", ops, sw,
+			       1e9 / sw);
+		}
+	}
+
+	printf("\nuthread_yield(): %.1f ns/switch\n",
+	       bench_uthread_yield(switches));
+
+	return 0;
+}
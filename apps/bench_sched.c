@@ -0,0 +1,286 @@
+/*
+ * Scheduler benchmark suite
+ *
+ * Runs the scheduler microbenchmarks which `make bench` tracks across library
+ * versions, and reports the distribution of each of them in a machine-readable
+ * format, so that two runs can be diffed or plotted:
+ * - yield: switch latency of two threads ping-ponging with uthread_yield()
+ * - create_join: a thread created and joined right away
+ * - fanout_join: a thread of a fan-out of FANOUT threads, all joined by main
+ * - preempt_tick: a preemption tick, every PREEMPT_US, switching between two
+ *   spinning threads, timed as the time it takes away from the spinners
+ *
+ * A sample times a batch of operations, as reading the clock can cost as much
+ * as a switch (e.g. in a virtual machine trapping the time-stamp counter), and
+ * is reported in nanoseconds per operation (or per tick).
+ *
+ * Usage: bench_sched.x [csv|json] [samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_SAMPLES 1000
+#define BATCH 64 // operations per sample
+#define FANOUT 256
+#define TICK_BATCH 8 // ticks per sample of preempt_tick
+#define PREEMPT_US 100
+
+struct result {
+	const char *name;
+	const char *unit;
+	double *samples;
+	int nr_samples;
+};
+
+static int nr_samples;
+static double *samples;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Ping-pong partner, yielding as many times as the timing thread */
+static int yielder(void)
+{
+	for (int i = 0; i < nr_samples * BATCH; i++)
+		uthread_yield();
+	return 0;
+}
+
+static int yield_timer(void)
+{
+	for (int i = 0; i < nr_samples; i++) {
+		double start = now_ns();
+
+		for (int j = 0; j < BATCH; j++)
+			uthread_yield();
+		// Each yield switches to the partner and back
+		samples[i] = (now_ns() - start) / (2 * BATCH);
+	}
+	return 0;
+}
+
+static void bench_yield(void)
+{
+	uthread_t timer, partner;
+
+	uthread_start(0);
+	timer = uthread_create(yield_timer);
+	partner = uthread_create(yielder);
+	uthread_join(timer, NULL);
+	uthread_join(partner, NULL);
+	uthread_stop();
+}
+
+static int noop(void)
+{
+	return 0;
+}
+
+static void bench_create_join(void)
+{
+	uthread_start(0);
+	for (int i = 0; i < nr_samples; i++) {
+		double start = now_ns();
+
+		for (int j = 0; j < BATCH; j++)
+			uthread_join(uthread_create(noop), NULL);
+		samples[i] = (now_ns() - start) / BATCH;
+	}
+	uthread_stop();
+}
+
+static void bench_fanout_join(void)
+{
+	uthread_t tids[FANOUT];
+
+	uthread_start(0);
+	for (int i = 0; i < nr_samples; i++) {
+		double start = now_ns();
+
+		for (int j = 0; j < FANOUT; j++)
+			tids[j] = uthread_create(noop);
+		for (int j = 0; j < FANOUT; j++)
+			uthread_join(tids[j], NULL);
+		samples[i] = (now_ns() - start) / FANOUT;
+	}
+	uthread_stop();
+}
+
+/* Latest time read by each spinner, and spinner which read the latest one */
+static volatile double spin_last[2];
+static volatile int spin_owner = -1;
+static int nr_ticks, nr_tick_samples;
+static double tick_sum;
+
+/*
+ * Spin reading the clock, until enough ticks were sampled. As the spinners
+ * never yield, each time one of them takes over, a tick preempted the other
+ * one: the time since the other one's latest reading is the tick's cost, along
+ * with a clock reading.
+ */
+static int tick_spin(int me)
+{
+	while (nr_tick_samples < nr_samples) {
+		int other = spin_owner;
+		double last, now;
+
+		if (other == me) {
+			spin_last[me] = now_ns();
+			continue;
+		}
+		last = spin_last[other];
+		now = now_ns();
+		spin_last[me] = now;
+		spin_owner = me;
+		if (other == -1) continue; // first spinner to run, not a tick
+
+		tick_sum += now - last;
+		if (++nr_ticks % TICK_BATCH == 0) {
+			samples[nr_tick_samples++] = tick_sum / TICK_BATCH;
+			tick_sum = 0;
+		}
+	}
+	return 0;
+}
+
+static int tick_spinner_a(void)
+{
+	return tick_spin(0);
+}
+
+static int tick_spinner_b(void)
+{
+	return tick_spin(1);
+}
+
+/*
+ * Two spinners keep each other ready, so that the timer stays armed and every
+ * tick switches from one to the other. The ticks count elapsed time, as timers
+ * counting CPU time only fire at the kernel's own tick rate.
+ */
+static void bench_preempt_tick(void)
+{
+	uthread_opts_t opts;
+	uthread_t a, b;
+
+	spin_owner = -1;
+	nr_ticks = nr_tick_samples = 0;
+	tick_sum = 0;
+	uthread_opts_init(&opts);
+	opts.preempt = UTHREAD_PREEMPT_ASYNC;
+	opts.quantum_us = PREEMPT_US;
+	opts.clock = CLOCK_MONOTONIC;
+	uthread_start_opts(&opts);
+	a = uthread_create(tick_spinner_a);
+	b = uthread_create(tick_spinner_b);
+	uthread_join(a, NULL);
+	uthread_join(b, NULL);
+	uthread_stop();
+}
+
+static const struct {
+	const char *name;
+	const char *unit;
+	void (*run)(void);
+} benches[] = {
+	{"yield", "ns/op", bench_yield},
+	{"create_join", "ns/op", bench_create_join},
+	{"fanout_join", "ns/op", bench_fanout_join},
+	{"preempt_tick", "ns/tick", bench_preempt_tick},
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* @s must be sorted */
+static double percentile(const double *s, int n, double p)
+{
+	return s[(int)(p * (n - 1))];
+}
+
+static double mean(const double *s, int n)
+{
+	double sum = 0;
+
+	for (int i = 0; i < n; i++)
+		sum += s[i];
+	return sum / n;
+}
+
+static void print_csv(const struct result *res, int n)
+{
+	printf("bench,unit,samples,mean,p50,p90,p99,max\n");
+	for (int i = 0; i < n; i++) {
+		const double *s = res[i].samples;
+		int ns = res[i].nr_samples;
+
+		printf("%s,%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f\n", res[i].name, res[i].unit, ns,
+		       mean(s, ns), percentile(s, ns, 0.5),
+		       percentile(s, ns, 0.9), percentile(s, ns, 0.99), s[ns - 1]);
+	}
+}
+
+static void print_json(const struct result *res, int n)
+{
+	printf("[\n");
+	for (int i = 0; i < n; i++) {
+		const double *s = res[i].samples;
+		int ns = res[i].nr_samples;
+
+		printf("  {\"bench\": \"%s\", \"unit\": \"%s\", \"samples\": %d, "
+		       "\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+		       "\"max\": %.1f}%s\n", res[i].name, res[i].unit, ns, mean(s, ns),
+		       percentile(s, ns, 0.5), percentile(s, ns, 0.9),
+		       percentile(s, ns, 0.99), s[ns - 1], i < n - 1 ? "," : "");
+	}
+	printf("]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *format = argc > 1 ? argv[1] : "csv";
+	struct result res[NR_BENCHES];
+
+	nr_samples = argc > 2 ? atoi(argv[2]) : DEFAULT_SAMPLES;
+	if ((strcmp(format, "csv") && strcmp(format, "json")) || nr_samples <= 0) {
+		fprintf(stderr, "usage: %s [csv|json] [samples]\n", argv[0]);
+		return 1;
+	}
+
+	for (size_t i = 0; i < NR_BENCHES; i++) {
+		samples = malloc(nr_samples * sizeof(*samples));
+		if (samples == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		benches[i].run();
+		qsort(samples, nr_samples, sizeof(*samples), cmp_double);
+		res[i] = (struct result){benches[i].name, benches[i].unit, samples, nr_samples};
+	}
+
+	if (strcmp(format, "csv") == 0)
+		print_csv(res, NR_BENCHES);
+	else
+		print_json(res, NR_BENCHES);
+
+	for (size_t i = 0; i < NR_BENCHES; i++)
+		free(res[i].samples);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Sleep benchmark
+ *
+ * Many threads sleep at once, each for a random time within a window, as
+ * connections waiting for their timeouts would. Reports how late the threads
+ * wake up past their deadlines (p50/p99/max), and the CPU time the process
+ * used over the whole window, which stays low as idle workers block until the
+ * nearest deadline.
+ *
+ * Usage: bench_sleep.x [threads] [window ms]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_THREADS 100000
+#define DEFAULT_WINDOW_MS 1000
+
+static int nr_threads;
+static long window_ns;
+static atomic_int next_thread;
+static long *delays; // in nanoseconds, one per thread
+static double *lateness; // in nanoseconds, one per thread
+
+static double clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int sleeper(void)
+{
+	int id = atomic_fetch_add(&next_thread, 1);
+	double due = clock_ns(CLOCK_MONOTONIC) + delays[id];
+
+	uthread_sleep_ns(delays[id]);
+	lateness[id] = clock_ns(CLOCK_MONOTONIC) - due;
+
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+	int window_ms = argc > 2 ? atoi(argv[2]) : DEFAULT_WINDOW_MS;
+	double start, cpu_start;
+	uthread_t *tids;
+
+	nr_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+	tids = malloc(nr_threads * sizeof(*tids));
+	delays = malloc(nr_threads * sizeof(*delays));
+	lateness = malloc(nr_threads * sizeof(*lateness));
+	if (nr_threads <= 0 || window_ms <= 0 || tids == NULL || delays == NULL
+	    || lateness == NULL) {
+		fprintf(stderr, "usage: %s [threads] [window ms]\n", argv[0]);
+		return 1;
+	}
+	window_ns = window_ms * 1000000L;
+	srand(1);
+	for (int i = 0; i < nr_threads; i++)
+		delays[i] = (long)rand() % window_ns;
+
+	uthread_start(0);
+	start = clock_ns(CLOCK_MONOTONIC);
+	cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+	for (int i = 0; i < nr_threads; i++) {
+		int tid = uthread_create(sleeper);
+
+		if (tid == -1) { // e.g. out of memory mappings for the stacks
+			fprintf(stderr, "only %d threads could be created\n", i);
+			nr_threads = i;
+			break;
+		}
+		tids[i] = tid;
+	}
+	for (int i = 0; i < nr_threads; i++)
+		uthread_join(tids[i], NULL);
+	printf("%d threads sleeping within %d ms: done in %.1f ms, %.1f ms of CPU\n",
+	       nr_threads, window_ms, (clock_ns(CLOCK_MONOTONIC) - start) / 1e6,
+	       (clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e6);
+	uthread_stop();
+
+	qsort(lateness, nr_threads, sizeof(*lateness), cmp_double);
+	printf("lateness us: p50 %.1f, p99 %.1f, max %.1f\n",
+	       lateness[nr_threads / 2] / 1e3,
+	       lateness[(int)(0.99 * (nr_threads - 1))] / 1e3,
+	       lateness[nr_threads - 1] / 1e3);
+	free(lateness);
+	free(delays);
+	free(tids);
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Fan-out spawn benchmark
+ *
+ * Spawns many threads at once, which each read their argument and exit, and
+ * joins all of them. Compares a loop of uthread_create_attr() calls against a
+ * single uthread_create_n_attr() call, reporting the time to spawn the threads
+ * and the time until they all got joined. Each mode runs twice, the second run
+ * reusing the stacks pooled by the first ones.
+ *
+ * Stacks have no guard region by default, and cannot grow: with either, each
+ * stack costs two memory mappings, and the kernel caps their number
+ * (vm.max_map_count) to about 65k.
+ *
+ * Usage: bench_spawn.x [threads] [guard size]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define DEFAULT_THREADS 100000
+
+static long sum;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int job(void)
+{
+	sum += (intptr_t)uthread_arg();
+	return 0;
+}
+
+/* Global counter standing in for the argument of a thread from the loop */
+static long next_arg;
+
+static int loop_job(void)
+{
+	sum += ++next_arg;
+	return 0;
+}
+
+static int spawn(int bulk, int n, const uthread_attr_t *attr, void **args,
+		 uthread_t *tids, double *spawn_ms, double *total_ms)
+{
+	double start, spawned;
+
+	sum = next_arg = 0;
+	start = now_ns();
+	if (bulk) {
+		if (uthread_create_n_attr(job, args, n, attr, tids) == -1) return -1;
+	} else {
+		for (int i = 0; i < n; i++) {
+			if ((tids[i] = uthread_create_attr(loop_job, attr)) == (uthread_t)-1) {
+				while (i-- > 0)
+					uthread_join(tids[i], NULL);
+				return -1;
+			}
+		}
+	}
+	spawned = now_ns();
+	for (int i = 0; i < n; i++)
+		uthread_join(tids[i], NULL);
+	*spawn_ms = (spawned - start) / 1e6;
+	*total_ms = (now_ns() - start) / 1e6;
+
+	return sum == (long)n * (n + 1) / 2 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+	uthread_attr_t attr;
+	uthread_t *tids;
+	void **args;
+
+	uthread_attr_init(&attr);
+	attr.guard_size = argc > 2 ? atol(argv[2]) : 0;
+	attr.stack_max = 0;
+	tids = malloc(n * sizeof(*tids));
+	args = malloc(n * sizeof(*args));
+	if (n <= 0 || tids == NULL || args == NULL) {
+		fprintf(stderr, "usage: %s [threads] [guard size]\n", argv[0]);
+		return 1;
+	}
+	for (int i = 0; i < n; i++)
+		args[i] = (void *)(intptr_t)(i + 1);
+
+	printf("%d threads, %zu B guards\n", n, attr.guard_size);
+	printf("%-22s %12s %12s\n", "mode", "spawn ms", "total ms");
+	uthread_start(0);
+	for (int run = 0; run < 4; run++) {
+		int bulk = run % 2;
+		double spawn_ms, total_ms;
+
+		if (spawn(bulk, n, &attr, args, tids, &spawn_ms, &total_ms) == -1) {
+			fprintf(stderr, "spawning failed\n");
+			return 1;
+		}
+		printf("%-22s %12.1f %12.1f\n",
+		       bulk ? "uthread_create_n" : "uthread_create loop",
+		       spawn_ms, total_ms);
+	}
+	uthread_stop();
+	free(args);
+	free(tids);
+
+	return 0;
+}
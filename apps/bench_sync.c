@@ -0,0 +1,141 @@
+/*
+ * Lock contention benchmark
+ *
+ * Many threads repeatedly enter a short critical section protected by a single
+ * lock, doing some work outside of it in between. The lock is either a
+ * uthread_mutex_t, whose waiters block and get the lock handed over, or a
+ * yield-spin lock (an atomic flag, retried after a uthread_yield() while
+ * taken), which is what threads had to do before the library had mutexes.
+ * Each lock is measured with 1 and with the given number of workers, without
+ * and with preemption, which may switch the owner out within the critical
+ * section, and with critical sections which yield once midway, as an owner
+ * waiting for I/O would.
+ *
+ * Usage: bench_sync.x [workers] [threads] [iterations per thread]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <uthread.h>
+
+#define DEFAULT_THREADS 64
+#define DEFAULT_ITERS 20000
+#define INSIDE_WORK 50 // loop iterations within the critical section
+#define OUTSIDE_WORK 200 // loop iterations between two critical sections
+
+static long iters;
+static uthread_mutex_t mutex;
+static atomic_flag spin = ATOMIC_FLAG_INIT;
+static long counter;
+static int yield_inside; // whether the owner yields within the critical section
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void work(int amount)
+{
+	volatile unsigned long acc = 0;
+
+	for (int i = 0; i < amount; i++)
+		acc += i * i ^ (acc >> 3);
+}
+
+static int mutex_thread(void)
+{
+	for (long i = 0; i < iters; i++) {
+		uthread_mutex_lock(mutex);
+		counter++;
+		work(INSIDE_WORK);
+		if (yield_inside) uthread_yield();
+		uthread_mutex_unlock(mutex);
+		work(OUTSIDE_WORK);
+	}
+	return 0;
+}
+
+static int spin_thread(void)
+{
+	for (long i = 0; i < iters; i++) {
+		while (atomic_flag_test_and_set_explicit(&spin, memory_order_acquire))
+			uthread_yield();
+		counter++;
+		work(INSIDE_WORK);
+		if (yield_inside) uthread_yield();
+		atomic_flag_clear_explicit(&spin, memory_order_release);
+		work(OUTSIDE_WORK);
+	}
+	return 0;
+}
+
+/* Nanoseconds per critical section, or -1 if the count came out wrong */
+static double bench_lock(uthread_func_t func, int nr_workers, int preempt, int nr_thrs)
+{
+	uthread_opts_t opts;
+	uthread_t *tids = malloc(nr_thrs * sizeof(*tids));
+	double start, end;
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = nr_workers;
+	opts.preempt = preempt ? UTHREAD_PREEMPT_ASYNC : UTHREAD_PREEMPT_NONE;
+	if (tids == NULL || uthread_start_opts(&opts) == -1) {
+		fprintf(stderr, "uthread_start_opts failed\n");
+		exit(1);
+	}
+	mutex = uthread_mutex_create();
+	counter = 0;
+
+	start = now_ns();
+	for (int i = 0; i < nr_thrs; i++)
+		tids[i] = uthread_create(func);
+	for (int i = 0; i < nr_thrs; i++)
+		uthread_join(tids[i], NULL);
+	end = now_ns();
+
+	uthread_mutex_destroy(mutex);
+	uthread_stop();
+	free(tids);
+
+	if (counter != nr_thrs * iters) return -1;
+	return (end - start) / counter;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_workers = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int nr_thrs = argc > 2 ? atoi(argv[2]) : DEFAULT_THREADS;
+	int workers[2] = {1, max_workers};
+
+	iters = argc > 3 ? atol(argv[3]) : DEFAULT_ITERS;
+	if (max_workers <= 0 || nr_thrs <= 0 || iters <= 0) {
+		fprintf(stderr, "usage: %s [workers] [threads] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d threads x %ld critical sections, %ld online CPUs\n", nr_thrs,
+	       iters, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-12s %-8s %-8s %14s %16s\n", "owner", "workers", "preempt",
+	       "mutex ns/op", "yield-spin ns/op");
+	for (yield_inside = 0; yield_inside <= 1; yield_inside++) {
+		for (int i = 0; i < (max_workers > 1 ? 2 : 1); i++) {
+			for (int preempt = 0; preempt <= 1; preempt++) {
+				double m = bench_lock(mutex_thread, workers[i], preempt, nr_thrs);
+				double s = bench_lock(spin_thread, workers[i], preempt, nr_thrs);
+
+				printf("%-12s %-8d %-8s %14.1f %16.1f\n",
+				       yield_inside ? "yields" : "runs", workers[i],
+				       preempt ? "yes" : "no", m, s);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <deque.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+/* Test creating a deque */
+void test_create(void)
+{
+	fprintf(stderr, "*** TEST create ***\n");
+
+	deque_t d = deque_create();
+	TEST_ASSERT(d != NULL);
+	TEST_ASSERT(deque_length(d) == 0);
+	TEST_ASSERT(deque_destroy(d) == 0);
+}
+
+/* Test pushing and popping items, owner side */
+void test_push_pop(void)
+{
+	fprintf(stderr, "*** TEST push_pop ***\n");
+
+	int data1 = 10, data2 = 20, data3 = 30, *ptr;
+	deque_t d = deque_create();
+
+	// Null argument tests
+	TEST_ASSERT(deque_push(NULL, &data1) == -1);
+	TEST_ASSERT(deque_push(d, NULL) == -1);
+	TEST_ASSERT(deque_pop(NULL, (void**)&ptr) == -1);
+	TEST_ASSERT(deque_pop(d, NULL) == -1);
+
+	// Empty deque test
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == -1);
+
+	// The owner gets the newest item first
+	deque_push(d, &data1);
+	deque_push(d, &data2);
+	deque_push(d, &data3);
+	TEST_ASSERT(deque_length(d) == 3);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data3);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data2);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data1);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == -1);
+	TEST_ASSERT(deque_length(d) == 0);
+	TEST_ASSERT(deque_destroy(d) == 0);
+}
+
+/* Test stealing items, thief side */
+void test_steal(void)
+{
+	fprintf(stderr, "*** TEST steal ***\n");
+
+	int data1 = 10, data2 = 20, data3 = 30, *ptr;
+	deque_t d = deque_create();
+
+	// Null argument tests
+	TEST_ASSERT(deque_steal(NULL, (void**)&ptr) == -1);
+	TEST_ASSERT(deque_steal(d, NULL) == -1);
+
+	// Empty deque test
+	TEST_ASSERT(deque_steal(d, (void**)&ptr) == -1);
+
+	// Thieves get the oldest item first, the owner still the newest one
+	deque_push(d, &data1);
+	deque_push(d, &data2);
+	deque_push(d, &data3);
+	TEST_ASSERT(deque_steal(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data1);
+	TEST_ASSERT(deque_length(d) == 2);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data3);
+	TEST_ASSERT(deque_steal(d, (void**)&ptr) == 0);
+	TEST_ASSERT(ptr == &data2);
+	TEST_ASSERT(deque_steal(d, (void**)&ptr) == -1);
+	TEST_ASSERT(deque_pop(d, (void**)&ptr) == -1);
+	TEST_ASSERT(deque_destroy(d) == 0);
+}
+
+/* Test growing the deque past its initial capacity */
+void test_grow(void)
+{
+	fprintf(stderr, "*** TEST grow ***\n");
+
+	static int data[1000];
+	int *ptr, ok = 1;
+	deque_t d = deque_create();
+
+	// Wrap around the array a few times before growing it
+	for (int i = 0; i < 50; i++) {
+		deque_push(d, &data[0]);
+		deque_steal(d, (void**)&ptr);
+	}
+	for (int i = 0; i < 1000; i++)
+		ok = ok && deque_push(d, &data[i]) == 0;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(deque_length(d) == 1000);
+
+	for (int i = 0; i < 500; i++)
+		ok = ok && deque_steal(d, (void**)&ptr) == 0 && ptr == &data[i];
+	for (int i = 999; i >= 500; i--)
+		ok = ok && deque_pop(d, (void**)&ptr) == 0 && ptr == &data[i];
+	TEST_ASSERT(ok);
+	TEST_ASSERT(deque_length(d) == 0);
+	TEST_ASSERT(deque_destroy(d) == 0);
+}
+
+/* Test destroying a deque */
+void test_destroy(void)
+{
+	fprintf(stderr, "*** TEST destroy ***\n");
+
+	int data = 10, *ptr;
+	deque_t d = deque_create();
+
+	// Null argument test
+	TEST_ASSERT(deque_destroy(NULL) == -1);
+
+	// Still have items
+	deque_push(d, &data);
+	TEST_ASSERT(deque_destroy(d) == -1);
+
+	// No more items
+	deque_pop(d, (void**)&ptr);
+	TEST_ASSERT(deque_destroy(d) == 0);
+}
+
+#define NR_ITEMS 200000
+#define NR_THIEVES 4
+
+static deque_t shared_deque;
+static atomic_int taken[NR_ITEMS];
+static atomic_int owner_done;
+
+static void *thief(void *arg)
+{
+	atomic_int *ptr;
+	(void)arg;
+
+	while (!atomic_load(&owner_done) || deque_length(shared_deque) > 0) {
+		if (deque_steal(shared_deque, (void**)&ptr) == 0)
+			atomic_fetch_add(ptr, 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * Test the owner pushing and popping while thieves steal concurrently: every
+ * item must be taken exactly once
+ */
+void test_concurrent(void)
+{
+	fprintf(stderr, "*** TEST concurrent ***\n");
+
+	pthread_t thieves[NR_THIEVES];
+	atomic_int *ptr;
+	int ok = 1;
+
+	shared_deque = deque_create();
+	for (int i = 0; i < NR_THIEVES; i++)
+		pthread_create(&thieves[i], NULL, thief, NULL);
+
+	// Items are the addresses of the counters tracking them
+	for (int i = 0; i < NR_ITEMS; i++) {
+		deque_push(shared_deque, &taken[i]);
+		if (i % 3 == 0 && deque_pop(shared_deque, (void**)&ptr) == 0)
+			atomic_fetch_add(ptr, 1);
+	}
+	while (deque_pop(shared_deque, (void**)&ptr) == 0)
+		atomic_fetch_add(ptr, 1);
+	atomic_store(&owner_done, 1);
+
+	for (int i = 0; i < NR_THIEVES; i++)
+		pthread_join(thieves[i], NULL);
+	for (int i = 0; i < NR_ITEMS; i++)
+		ok = ok && atomic_load(&taken[i]) == 1;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(deque_destroy(shared_deque) == 0);
+}
+
+int main(void)
+{
+	test_create();
+	test_push_pop();
+	test_steal();
+	test_grow();
+	test_destroy();
+	test_concurrent();
+
+	return 0;
+}
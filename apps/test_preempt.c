@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <private.h>
 #include <queue.h>
@@ -40,6 +41,7 @@ void test_infinite_loop(void)
 	uthread_t tid;
 	int retval;
 
+	TEST_ASSERT(uthread_set_quantum(1000) == -1); // preemption not started
 	uthread_start(1); // enable preemption
 	uthread_create(thread1); // thread1 tid not used
 	tid = uthread_create(thread2);
@@ -49,8 +51,81 @@ void test_infinite_loop(void)
 	TEST_ASSERT(uthread_stop() == -1); // thread1 never ends, still in ready queue
 }
 
+volatile int poll_done;
+
+/* Thread that only gives way at its preemption points */
+int thread_poll(void)
+{
+	while (!poll_done)
+		uthread_maybe_yield();
+	return 3;
+}
+
+/* Test to see that a polling thread lets the main thread run again */
+void test_poll(void)
+{
+	fprintf(stderr, "*** TEST poll ***\n");
+
+	uthread_t tid;
+	int retval;
+
+	uthread_start(UTHREAD_PREEMPT_POLL);
+	TEST_ASSERT(uthread_set_quantum(0) == -1);
+	TEST_ASSERT(uthread_set_quantum(1000) == 0); // 1 ms time slices
+	tid = uthread_create(thread_poll);
+	uthread_yield(); // main thread yield to thread_poll
+	poll_done = 1;
+	TEST_ASSERT(uthread_join(tid, &retval) == 0);
+	TEST_ASSERT(retval == 3);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+#define NR_OFFLOADERS 8
+#define NR_OFFLOADS 20000
+
+static void *offload_inc(void *arg)
+{
+	return (char *)arg + 1;
+}
+
+/* Thread offloading calls back to back, which the timer keeps preempting */
+int thread_offload(void)
+{
+	for (long i = 0; i < NR_OFFLOADS; i++) {
+		if (uthread_offload(offload_inc, (void *)i) != (char *)i + 1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Test to see that threads preempted while offloading do not deadlock */
+void test_offload(void)
+{
+	fprintf(stderr, "*** TEST offload ***\n");
+
+	uthread_opts_t opts;
+	uthread_t tids[NR_OFFLOADERS];
+	int retval, failed = 0;
+
+	uthread_opts_init(&opts);
+	opts.preempt = UTHREAD_PREEMPT_ASYNC;
+	opts.quantum_us = 50;
+	opts.clock = CLOCK_MONOTONIC;
+	uthread_start_opts(&opts);
+	for (int i = 0; i < NR_OFFLOADERS; i++)
+		tids[i] = uthread_create(thread_offload);
+	for (int i = 0; i < NR_OFFLOADERS; i++) {
+		if (uthread_join(tids[i], &retval) != 0 || retval != 0)
+			failed++;
+	}
+	TEST_ASSERT(failed == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
 int main(void)
 {
+	test_poll();
+	test_offload();
 	test_infinite_loop();
 	return 0;
 }
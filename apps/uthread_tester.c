@@ -2,8 +2,16 @@
  * Tests creations of threads and successful returns.
  */
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <uthread.h>
 
@@ -121,6 +129,1146 @@ void test_collect_dead_thr(void) {
 	TEST_ASSERT(uthread_stop() == 0);
 }
 
+/**
+ * Tests that TIDs of collected threads are recycled under a new generation
+ * - A stale TID cannot be joined again, even once its slot is reused
+ * - More than USHRT_MAX threads can be created over the library's lifetime
+ */
+void test_tid_recycling(void)
+{
+	fprintf(stderr, "*** TEST tid_recycling ***\n");
+
+	uthread_t tid, stale_tid;
+	int retval, ok = 1;
+
+	uthread_start(0);
+	stale_tid = uthread_create(five);
+	TEST_ASSERT(uthread_join(stale_tid, &retval) == 0);
+	TEST_ASSERT(uthread_join(stale_tid, &retval) == -1);
+
+	tid = uthread_create(hello); // reuses the slot of stale_tid
+	TEST_ASSERT(tid != stale_tid);
+	TEST_ASSERT(uthread_join(stale_tid, &retval) == -1);
+	TEST_ASSERT(uthread_join(tid, &retval) == 0);
+
+	for (int i = 0; i < 70000 && ok; i++) {
+		tid = uthread_create(five);
+		ok = uthread_join(tid, &retval) == 0 && retval == 5;
+	}
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+/* Recursion deep enough to overflow a default-sized stack */
+static int recurse(int depth)
+{
+	volatile char frame[1024];
+
+	frame[0] = 1;
+	if (depth == 0) return 0;
+	return recurse(depth - 1) + frame[0];
+}
+
+int deep_thr(void)
+{
+	return recurse(512); // about 512 KiB of stack
+}
+
+/**
+ * Tests creating threads with custom attributes
+ */
+void test_create_attr(void)
+{
+	fprintf(stderr, "*** TEST create_attr ***\n");
+
+	uthread_attr_t attr;
+	uthread_t tid;
+	int retval;
+
+	uthread_start(0);
+	uthread_attr_init(&attr);
+	attr.stack_size = 1 << 20;
+	tid = uthread_create_attr(deep_thr, &attr);
+	TEST_ASSERT(uthread_join(tid, &retval) == 0);
+	TEST_ASSERT(retval == 512);
+
+	attr.stack_size = 1; // rounded up to the minimum stack size
+	attr.guard_size = 0;
+	tid = uthread_create_attr(five, &attr);
+	TEST_ASSERT(uthread_join(tid, &retval) == 0);
+	TEST_ASSERT(retval == 5);
+
+	TEST_ASSERT(uthread_join(uthread_create_attr(hello, NULL), &retval) == 0);
+	TEST_ASSERT(retval == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+/* Returns the number it was given as argument */
+int arg_thr(void)
+{
+	return (int)(intptr_t)uthread_arg();
+}
+
+/**
+ * Tests creating many threads at once
+ * - Every thread gets its own argument
+ * - Invalid arguments create no thread
+ * - Threads without arguments get NULL, also in M:N mode
+ */
+void test_create_n(void)
+{
+	fprintf(stderr, "*** TEST create_n ***\n");
+
+	uthread_opts_t opts;
+	uthread_attr_t attr;
+	uthread_t tids[100];
+	void *args[100];
+	int retval, ok = 1;
+
+	for (int i = 0; i < 100; i++)
+		args[i] = (void *)(intptr_t)(i + 1);
+
+	uthread_start(0);
+	TEST_ASSERT(uthread_create_n(arg_thr, args, 100, tids) == 0);
+	for (int i = 0; i < 100; i++)
+		ok = ok && uthread_join(tids[i], &retval) == 0 && retval == i + 1;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_create_n(arg_thr, args, 0, tids) == -1);
+	TEST_ASSERT(uthread_create_n(arg_thr, args, 1, NULL) == -1);
+	TEST_ASSERT(uthread_arg() == NULL);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = 4;
+	uthread_attr_init(&attr);
+	attr.guard_size = 0;
+	TEST_ASSERT(uthread_start_opts(&opts) == 0);
+	TEST_ASSERT(uthread_create_n_attr(arg_thr, NULL, 100, &attr, tids) == 0);
+	for (int i = 0; i < 100; i++)
+		ok = ok && uthread_join(tids[i], &retval) == 0 && retval == 0;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static int nr_detached_run;
+
+/* Fire-and-forget thread */
+int detached_thr(void)
+{
+	nr_detached_run++;
+	return 0;
+}
+
+/**
+ * Tests detached threads
+ * - Detached threads cannot be joined and are released when they exit
+ * - Detaching a zombie collects it right away
+ * - A thread cannot be detached twice, nor once joined
+ * - The library stops once all detached threads exited
+ */
+void test_detach(void)
+{
+	fprintf(stderr, "*** TEST detach ***\n");
+
+	uthread_opts_t opts;
+	uthread_attr_t attr;
+	uthread_t tid;
+	int ok = 1;
+
+	uthread_start(0);
+	nr_detached_run = 0;
+	tid = uthread_create(detached_thr);
+	TEST_ASSERT(uthread_detach(tid) == 0);
+	TEST_ASSERT(uthread_detach(tid) == -1);
+	TEST_ASSERT(uthread_join(tid, NULL) == -1);
+	uthread_yield();
+	TEST_ASSERT(nr_detached_run == 1);
+	TEST_ASSERT(uthread_detach(tid) == -1); // already released
+
+	tid = uthread_create(detached_thr);
+	uthread_yield(); // becomes a zombie
+	TEST_ASSERT(uthread_detach(tid) == 0);
+	TEST_ASSERT(uthread_join(tid, NULL) == -1);
+	TEST_ASSERT(uthread_detach(0) == -1);
+
+	uthread_attr_init(&attr);
+	attr.detached = 1;
+	for (int i = 0; i < 100000 && ok; i++) {
+		ok = uthread_create_attr(detached_thr, &attr) != -1;
+		if (i % 100 == 99) uthread_yield();
+	}
+	uthread_yield();
+	TEST_ASSERT(ok && nr_detached_run == 100002);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = 4;
+	TEST_ASSERT(uthread_start_opts(&opts) == 0);
+	nr_detached_run = 0;
+	for (int i = 0; i < 1000 && ok; i++)
+		ok = uthread_create_attr(detached_thr, &attr) != -1;
+	TEST_ASSERT(ok);
+	while (uthread_stop() == -1) // until the other workers are done
+		uthread_yield();
+}
+
+/* Yields 10 times, spinning a bit in between */
+int stats_thr(void)
+{
+	volatile long spin = 0;
+
+	for (int i = 0; i < 10; i++) {
+		while (spin < (i + 1) * 100000)
+			spin++;
+		uthread_yield();
+	}
+	return 0;
+}
+
+/**
+ * Tests the scheduler statistics, unless compiled out of the library
+ * - Switches, run and ready times of threads are accounted for
+ * - Creations and joins are counted, as well as the ready queue length
+ */
+void test_stats(void)
+{
+	fprintf(stderr, "*** TEST stats ***\n");
+
+	uthread_global_stats_t global;
+	uthread_stats_t stats;
+	uthread_t tids[4];
+
+	uthread_start(0);
+	if (uthread_stats_global(&global) == -1) {
+		printf("statistics compiled out\n");
+		TEST_ASSERT(uthread_stats_get(0, &stats) == -1);
+		TEST_ASSERT(uthread_stop() == 0);
+		return;
+	}
+	TEST_ASSERT(global.nr_creates == 0 && global.nr_joins == 0);
+
+	for (int i = 0; i < 4; i++)
+		tids[i] = uthread_create(stats_thr);
+	uthread_yield();
+	TEST_ASSERT(uthread_stats_get(tids[0], &stats) == 0);
+	TEST_ASSERT(stats.nr_voluntary == 1 && stats.nr_involuntary == 0);
+	TEST_ASSERT(stats.run_ns > 0 && stats.ready_ns > 0);
+	for (int i = 1; i < 4; i++)
+		uthread_join(tids[i], NULL);
+	TEST_ASSERT(uthread_stats_get(tids[0], &stats) == 0); // a zombie by now
+	TEST_ASSERT(stats.nr_voluntary == 11);
+	TEST_ASSERT(stats.ready_ns > 0 && stats.run_ns > stats.ready_ns / 8);
+	uthread_join(tids[0], NULL);
+	TEST_ASSERT(uthread_stats_get(tids[0], &stats) == -1);
+	TEST_ASSERT(uthread_stats_get(uthread_self(), &stats) == 0);
+	TEST_ASSERT(stats.run_ns > 0);
+	TEST_ASSERT(uthread_stats_get(0, NULL) == -1);
+
+	TEST_ASSERT(uthread_stats_global(&global) == 0);
+	TEST_ASSERT(global.nr_creates == 4 && global.nr_joins == 4);
+	TEST_ASSERT(global.max_ready == 4);
+	TEST_ASSERT(global.nr_ticks_taken == 0 && global.nr_ticks_deferred == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+/* Yields twice */
+int traced_thr(void)
+{
+	uthread_yield();
+	uthread_yield();
+	return 3;
+}
+
+/* Counts the occurrences of @pattern in file @path */
+static int count_in_file(const char *path, const char *pattern)
+{
+	char line[512];
+	int count = 0;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL) return -1;
+	while (fgets(line, sizeof(line), f))
+		count += strstr(line, pattern) != NULL;
+	fclose(f);
+	return count;
+}
+
+/**
+ * Tests the scheduling event trace
+ * - Nothing is dumped without a trace, nor while tracing
+ * - Creations, switches with their reasons, wakeups and exits get recorded
+ * - Only the most recent events are kept
+ */
+void test_trace(void)
+{
+	fprintf(stderr, "*** TEST trace ***\n");
+
+	char path[] = "/tmp/uthread_traceXXXXXX";
+	uthread_t tids[2];
+	int fd;
+
+	fd = mkstemp(path);
+	TEST_ASSERT(fd != -1);
+	close(fd);
+
+	TEST_ASSERT(uthread_trace_start(16) == -1); // library not running
+	uthread_start(0);
+	TEST_ASSERT(uthread_trace_dump(path) == -1);
+	TEST_ASSERT(uthread_trace_start(0) == -1);
+	TEST_ASSERT(uthread_trace_start(1024) == 0);
+	TEST_ASSERT(uthread_trace_dump(path) == -1);
+	tids[0] = uthread_create(traced_thr);
+	tids[1] = uthread_create(traced_thr);
+	uthread_yield(); // opens a slice for the main thread, started untraced
+	uthread_join(tids[0], NULL); // blocks until woken up by its exit
+	uthread_join(tids[1], NULL);
+	uthread_trace_stop();
+	TEST_ASSERT(uthread_trace_dump(path) == 0);
+	TEST_ASSERT(count_in_file(path, "\"traceEvents\"") == 1);
+	TEST_ASSERT(count_in_file(path, "\"create\"") == 2);
+	TEST_ASSERT(count_in_file(path, "\"exit\",") == 2);
+	TEST_ASSERT(count_in_file(path, "\"wake\"") == 1);
+	TEST_ASSERT(count_in_file(path, "\"reason\":\"yield\"") == 4);
+	TEST_ASSERT(count_in_file(path, "\"reason\":\"block\"") == 1);
+	TEST_ASSERT(count_in_file(path, "\"reason\":\"exit\"") == 2);
+
+	TEST_ASSERT(uthread_trace_start(4) == 0);
+	for (int i = 0; i < 10; i++)
+		uthread_join(uthread_create(traced_thr), NULL);
+	uthread_trace_stop();
+	TEST_ASSERT(uthread_trace_dump(path) == 0);
+	TEST_ASSERT(count_in_file(path, "\"ph\":") <= 2 * 4 + 1); // E and B per switch
+	TEST_ASSERT(uthread_stop() == 0);
+	TEST_ASSERT(uthread_trace_dump(path) == -1); // released with the library
+	unlink(path);
+}
+
+/* Uses about 8 KiB of stack */
+int deep_stack_thr(void)
+{
+	volatile char buf[8192];
+
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = 0;
+	return buf[100];
+}
+
+int shallow_stack_thr(void)
+{
+	return 0;
+}
+
+/**
+ * Tests the stack high-water mark
+ * - Painted stacks report how deep their thread went, even once exited
+ * - Exited threads are counted in the histogram
+ * - Unpainted stacks and the main thread have no usage
+ */
+void test_stack_usage(void)
+{
+	fprintf(stderr, "*** TEST stack_usage ***\n");
+
+	unsigned long hist[UTHREAD_STACK_HIST_BUCKETS];
+	unsigned long total = 0;
+	uthread_t deep, shallow, plain;
+	long used;
+
+	uthread_start(0);
+	uthread_set_stack_paint(1);
+	deep = uthread_create(deep_stack_thr);
+	shallow = uthread_create(shallow_stack_thr);
+	uthread_set_stack_paint(0);
+	plain = uthread_create(shallow_stack_thr);
+	uthread_yield(); // all of them exit
+
+	used = uthread_stack_usage(deep);
+	TEST_ASSERT(used > 8192 && used < 16384);
+	used = uthread_stack_usage(shallow);
+	TEST_ASSERT(used > 0 && used <= 1024);
+	TEST_ASSERT(uthread_stack_usage(plain) == -1);
+	TEST_ASSERT(uthread_stack_usage(0) == -1);
+
+	TEST_ASSERT(uthread_stack_histogram(NULL) == -1);
+	TEST_ASSERT(uthread_stack_histogram(hist) == 0);
+	for (int i = 0; i < UTHREAD_STACK_HIST_BUCKETS; i++)
+		total += hist[i];
+	TEST_ASSERT(total == 2);
+	TEST_ASSERT(hist[0] == 1); // up to 1 KiB
+	TEST_ASSERT(hist[4] == 1); // up to 16 KiB
+
+	uthread_join(deep, NULL);
+	uthread_join(shallow, NULL);
+	uthread_join(plain, NULL);
+	TEST_ASSERT(uthread_stack_usage(deep) == -1); // collected
+	uthread_stop();
+}
+
+/* Goes @depth frames of about 1 KiB deep, yielding on the way down */
+int recurse_yield(int depth)
+{
+	volatile char frame[1000];
+
+	frame[0] = 1;
+	if (depth % 16 == 0) uthread_yield();
+	if (depth == 0) return 0;
+	return recurse_yield(depth - 1) + frame[0];
+}
+
+/* Goes about 200 KiB deep in a single function */
+int big_frame_thr(void)
+{
+	volatile char buf[200 * 1024];
+
+	for (size_t i = 0; i < sizeof(buf); i += 4096)
+		buf[i] = 1;
+	return buf[0] + 1;
+}
+
+int recurse_thr(void)
+{
+	return recurse_yield(500) - 496; // about 500 KiB
+}
+
+static volatile sig_atomic_t nr_user_segv;
+
+static void user_segv(int sig)
+{
+	(void)sig;
+	nr_user_segv++;
+}
+
+static volatile int edge_done;
+
+/*
+ * Moves its stack pointer close to the end of an 8 KiB stack without touching
+ * the memory below, and gets preempted there: signal frames do not fit
+ */
+int edge_thr(void)
+{
+	int n = 7400;
+	volatile char frame[n];
+	struct timespec start, now;
+
+	frame[n - 1] = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec < 20000000);
+	edge_done = 1;
+	return frame[n - 1];
+}
+
+int edge_spinner(void)
+{
+	while (!edge_done)
+		;
+	return 0;
+}
+
+/**
+ * Tests growable stacks
+ * - Threads starting with 8 KiB of stack go hundreds of KiB deep, gradually or
+ *   at once, also while being preempted and migrated
+ * - Threads with the default attributes go as deep
+ * - Stacks grow for the preemption signal frames as well
+ * - Going past the limit is still fatal
+ * - SIGSEGV sent by a process reaches the previous action, the default one
+ *   killing the process, and stacks still grow after a handler caught it
+ */
+void test_stack_grow(void)
+{
+	fprintf(stderr, "*** TEST stack_grow ***\n");
+
+	uthread_opts_t opts;
+	uthread_attr_t attr;
+	uthread_t tids[8];
+	int retval, ok = 1;
+	pid_t pid;
+	int status;
+
+	uthread_attr_init(&attr);
+	attr.stack_size = 8192;
+	attr.stack_max = 1024 * 1024;
+
+	uthread_start(0);
+	uthread_set_stack_paint(1);
+	tids[0] = uthread_create_attr(big_frame_thr, &attr);
+	tids[1] = uthread_create_attr(recurse_thr, &attr);
+	tids[2] = uthread_create(recurse_thr);
+	uthread_set_stack_paint(0);
+	for (int i = 0; i < 500 / 16 + 1; i++) // until they all exit
+		uthread_yield();
+	TEST_ASSERT(uthread_stack_usage(tids[0]) > 200 * 1024);
+	TEST_ASSERT(uthread_stack_usage(tids[1]) > 500 * 1000);
+	TEST_ASSERT(uthread_stack_usage(tids[2]) > 500 * 1000);
+	TEST_ASSERT(uthread_join(tids[0], &retval) == 0 && retval == 2);
+	TEST_ASSERT(uthread_join(tids[1], &retval) == 0 && retval == 4);
+	TEST_ASSERT(uthread_join(tids[2], &retval) == 0 && retval == 4);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	uthread_opts_init(&opts);
+	opts.preempt = 1;
+	opts.nr_workers = 4;
+	opts.quantum_us = 100;
+	TEST_ASSERT(uthread_start_opts(&opts) == 0);
+	TEST_ASSERT(uthread_create_n_attr(recurse_thr, NULL, 4, &attr, tids) == 0);
+	for (int i = 4; i < 8; i++)
+		tids[i] = uthread_create_attr(recurse_thr, &attr);
+	for (int i = 0; i < 8; i++)
+		ok &= uthread_join(tids[i], &retval) == 0 && retval == 4;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	uthread_opts_init(&opts);
+	opts.preempt = 1;
+	opts.quantum_us = 100;
+	opts.clock = CLOCK_MONOTONIC;
+	TEST_ASSERT(uthread_start_opts(&opts) == 0);
+	tids[0] = uthread_create_attr(edge_thr, &attr);
+	tids[1] = uthread_create(edge_spinner);
+	TEST_ASSERT(uthread_join(tids[0], &retval) == 0 && retval == 1);
+	TEST_ASSERT(uthread_join(tids[1], NULL) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	// A child process overflows a stack limited to 64 KiB
+	fflush(NULL);
+	pid = fork();
+	if (pid == 0) {
+		attr.stack_max = 64 * 1024;
+		uthread_start(0);
+		uthread_join(uthread_create_attr(big_frame_thr, &attr), NULL);
+		_exit(0);
+	}
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+	TEST_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+	pid = fork();
+	if (pid == 0) {
+		uthread_start(0);
+		raise(SIGSEGV);
+		_exit(0);
+	}
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+	TEST_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+	pid = fork();
+	if (pid == 0) {
+		struct sigaction act = {.sa_handler = user_segv};
+
+		sigaction(SIGSEGV, &act, NULL);
+		uthread_start(0);
+		raise(SIGSEGV);
+		ok = uthread_join(uthread_create_attr(recurse_thr, &attr), &retval) == 0
+			&& retval == 4;
+		raise(SIGSEGV);
+		_exit(ok && nr_user_segv == 2 && uthread_stop() == 0 ? 0 : 1);
+	}
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+	TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* CPU-bound thread yielding every now and then */
+int crunch(void)
+{
+	volatile long sum = 0;
+
+	for (int i = 0; i < 100000; i++) {
+		sum += i % 7;
+		if (i % 10000 == 0) uthread_yield();
+	}
+	return sum == 299995 ? 7 : -1;
+}
+
+/* Joins a thread created on whichever worker it runs */
+int crunch_joiner(void)
+{
+	int retval = 0;
+
+	uthread_join(uthread_create(crunch), &retval);
+	return retval;
+}
+
+/**
+ * Tests the M:N mode
+ * - Threads spread over several workers and are all collected
+ * - Threads can join threads that run on other workers
+ */
+void test_mn(void)
+{
+	fprintf(stderr, "*** TEST mn ***\n");
+
+	uthread_opts_t opts;
+	uthread_t tids[32];
+	int retval, ok = 1;
+
+	uthread_opts_init(&opts);
+	opts.nr_workers = 4;
+	TEST_ASSERT(uthread_start_opts(&opts) == 0);
+	for (int i = 0; i < 32; i++)
+		tids[i] = uthread_create(i % 2 ? crunch : crunch_joiner);
+	for (int i = 0; i < 32; i++)
+		ok = ok && uthread_join(tids[i], &retval) == 0 && retval == 7;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static uthread_t run_order[3];
+static int nr_run;
+
+/* Records the order in which threads get to run */
+int prio_thr(void)
+{
+	uthread_yield(); // only gives way to threads of the same or higher priority
+	run_order[nr_run++] = uthread_self();
+	return 0;
+}
+
+/**
+ * Tests priority scheduling
+ * - Yielding never runs a lower priority thread
+ * - Ready threads run by priority, whether set at creation or later on
+ */
+void test_priority(void)
+{
+	fprintf(stderr, "*** TEST priority ***\n");
+
+	uthread_attr_t attr;
+	uthread_t a, b, c;
+
+	uthread_start(0);
+	uthread_attr_init(&attr);
+	TEST_ASSERT(attr.priority == UTHREAD_PRIO_DEFAULT);
+	attr.priority = UTHREAD_PRIO_LEVELS;
+	TEST_ASSERT(uthread_create_attr(prio_thr, &attr) == -1);
+
+	attr.priority = 20;
+	a = uthread_create_attr(prio_thr, &attr);
+	b = uthread_create_attr(prio_thr, &attr);
+	uthread_yield();
+	TEST_ASSERT(nr_run == 0);
+
+	attr.priority = 5;
+	c = uthread_create_attr(prio_thr, &attr);
+	TEST_ASSERT(uthread_set_priority(b, 1) == 0);
+	TEST_ASSERT(uthread_set_priority(b, -1) == -1);
+	TEST_ASSERT(uthread_set_priority(12345, 1) == -1);
+	uthread_join(a, NULL);
+	uthread_join(b, NULL);
+	uthread_join(c, NULL);
+	TEST_ASSERT(nr_run == 3);
+	TEST_ASSERT(run_order[0] == b && run_order[1] == c && run_order[2] == a);
+	TEST_ASSERT(uthread_set_priority(a, 1) == -1); // collected
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+#define IO_BYTES (1 << 20) // more than a socket buffer holds
+static int io_fds[2];
+
+/* Reads everything sent through the socket pair, blocking until it arrives */
+int io_reader(void)
+{
+	static char buf[4096];
+	long total = 0, sum = 0;
+	ssize_t n;
+
+	while ((n = uthread_read(io_fds[1], buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < n; i++)
+			sum += (unsigned char)buf[i];
+		total += n;
+	}
+	return n == 0 && total == IO_BYTES && sum == (long)IO_BYTES / 256 * (255 * 256 / 2);
+}
+
+/* Writes to the socket pair, blocking whenever its buffer is full */
+int io_writer(void)
+{
+	static char buf[IO_BYTES];
+	long written = 0;
+
+	for (int i = 0; i < IO_BYTES; i++)
+		buf[i] = i % 256;
+	while (written < IO_BYTES) {
+		ssize_t n = uthread_write(io_fds[0], buf + written, IO_BYTES - written);
+		if (n < 0) return 0;
+		written += n;
+	}
+	return uthread_close(io_fds[0]) == 0;
+}
+
+/**
+ * Tests non-blocking I/O
+ * - A reader blocks until data arrives, a writer until there is room for more
+ * - Both sides keep waiting on each other until everything went through,
+ *   with one or several workers
+ */
+void test_io(void)
+{
+	fprintf(stderr, "*** TEST io ***\n");
+
+	uthread_opts_t opts;
+
+	for (int workers = 1; workers <= 4; workers *= 4) {
+		int reader_ok = 0, writer_ok = 0;
+		uthread_t reader;
+
+		TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, io_fds) == 0);
+		uthread_opts_init(&opts);
+		opts.nr_workers = workers;
+		TEST_ASSERT(uthread_start_opts(&opts) == 0);
+		reader = uthread_create(io_reader); // gets to wait first
+		uthread_yield();
+		uthread_join(uthread_create(io_writer), &writer_ok);
+		uthread_join(reader, &reader_ok);
+		TEST_ASSERT(writer_ok && reader_ok);
+		TEST_ASSERT(uthread_close(io_fds[1]) == 0);
+		TEST_ASSERT(uthread_stop() == 0);
+	}
+}
+
+static volatile int offload_done;
+static long offload_spins;
+
+/* Blocks its kernel thread, as a disk access would */
+static void *slow_call(void *arg)
+{
+	struct timespec ts = {0, 20 * 1000 * 1000};
+
+	nanosleep(&ts, NULL);
+	errno = EIO;
+	return (char *)arg + 1;
+}
+
+/* Keeps computing while another thread waits for an offloaded call */
+int spinner(void)
+{
+	while (!offload_done) {
+		offload_spins++;
+		uthread_yield();
+	}
+	return 0;
+}
+
+/**
+ * Tests offloading blocking calls
+ * - Other threads keep running while the call blocks a helper kernel thread
+ * - The call's return value and errno are passed back
+ */
+void test_offload(void)
+{
+	fprintf(stderr, "*** TEST offload ***\n");
+
+	static char base[2];
+	uthread_t tid;
+	void *ret;
+
+	uthread_start(0);
+	tid = uthread_create(spinner);
+	errno = 0;
+	ret = uthread_offload(slow_call, base);
+	TEST_ASSERT(ret == base + 1 && errno == EIO);
+	TEST_ASSERT(offload_spins > 0);
+	offload_done = 1;
+	uthread_join(tid, NULL);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static uthread_t wake_order[3];
+static int nr_woken;
+
+/* Sleeps for as many times 10 ms as its TID */
+int sleeper(void)
+{
+	struct timespec start, end;
+	long ms = uthread_self() * 10;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uthread_sleep_ns(ms * 1000 * 1000);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wake_order[nr_woken++] = uthread_self();
+
+	return (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 >= ms;
+}
+
+/**
+ * Tests sleeping
+ * - Threads wake up in deadline order, and never early
+ * - Sleeping while no other thread is ready does not burn CPU time
+ * - Deadlines already over and invalid ones return right away
+ */
+void test_sleep(void)
+{
+	fprintf(stderr, "*** TEST sleep ***\n");
+
+	struct timespec cpu_start, cpu_end, deadline = {0, 0};
+	uthread_t tids[3];
+	int retval, ok = 1;
+	long cpu_ms;
+
+	uthread_start(0);
+	for (int i = 0; i < 3; i++)
+		tids[i] = uthread_create(sleeper);
+	for (int i = 0; i < 3; i++)
+		ok = ok && uthread_join(tids[i], &retval) == 0 && retval == 1;
+	TEST_ASSERT(ok);
+	TEST_ASSERT(nr_woken == 3);
+	TEST_ASSERT(wake_order[0] == 1 && wake_order[1] == 2 && wake_order[2] == 3);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	uthread_sleep_ns(50 * 1000 * 1000);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000
+		+ (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000000;
+	TEST_ASSERT(cpu_ms < 10);
+
+	TEST_ASSERT(uthread_sleep_until(&deadline) == 0);
+	deadline.tv_nsec = 1000000000;
+	TEST_ASSERT(uthread_sleep_until(&deadline) == -1);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+#define SYNC_THREADS 8
+#define SYNC_LOOPS 2000
+static uthread_mutex_t sync_mutex;
+static long sync_counter;
+
+/* Increments the counter non-atomically, yielding within the critical section */
+int mutex_thr(void)
+{
+	for (int i = 0; i < SYNC_LOOPS; i++) {
+		uthread_mutex_lock(sync_mutex);
+		long value = sync_counter;
+		if (i % 16 == 0) uthread_yield();
+		sync_counter = value + 1;
+		uthread_mutex_unlock(sync_mutex);
+	}
+	return 0;
+}
+
+/**
+ * Tests mutexes
+ * - Critical sections exclude each other, with one or several workers
+ * - Only the owner can unlock, and cannot lock again
+ */
+void test_mutex(void)
+{
+	fprintf(stderr, "*** TEST mutex ***\n");
+
+	uthread_opts_t opts;
+	uthread_t tids[SYNC_THREADS];
+
+	for (int workers = 1; workers <= 4; workers *= 4) {
+		uthread_opts_init(&opts);
+		opts.nr_workers = workers;
+		opts.preempt = UTHREAD_PREEMPT_ASYNC;
+		opts.quantum_us = 1000;
+		TEST_ASSERT(uthread_start_opts(&opts) == 0);
+		sync_mutex = uthread_mutex_create();
+		sync_counter = 0;
+		for (int i = 0; i < SYNC_THREADS; i++)
+			tids[i] = uthread_create(mutex_thr);
+		for (int i = 0; i < SYNC_THREADS; i++)
+			uthread_join(tids[i], NULL);
+		TEST_ASSERT(sync_counter == SYNC_THREADS * SYNC_LOOPS);
+
+		TEST_ASSERT(uthread_mutex_unlock(sync_mutex) == -1);
+		TEST_ASSERT(uthread_mutex_lock(sync_mutex) == 0);
+		TEST_ASSERT(uthread_mutex_lock(sync_mutex) == -1);
+		TEST_ASSERT(uthread_mutex_trylock(sync_mutex) == -1);
+		TEST_ASSERT(uthread_mutex_destroy(sync_mutex) == -1);
+		TEST_ASSERT(uthread_mutex_unlock(sync_mutex) == 0);
+		TEST_ASSERT(uthread_mutex_destroy(sync_mutex) == 0);
+		TEST_ASSERT(uthread_stop() == 0);
+	}
+}
+
+#define BUF_SIZE 4
+static uthread_cond_t not_empty, not_full;
+static int buf[BUF_SIZE], buf_len, buf_head;
+
+/* Produces the integers 1 to SYNC_LOOPS into the bounded buffer */
+int producer(void)
+{
+	for (int i = 1; i <= SYNC_LOOPS; i++) {
+		uthread_mutex_lock(sync_mutex);
+		while (buf_len == BUF_SIZE)
+			uthread_cond_wait(not_full, sync_mutex);
+		buf[(buf_head + buf_len++) % BUF_SIZE] = i;
+		uthread_cond_signal(not_empty);
+		uthread_mutex_unlock(sync_mutex);
+	}
+	return 0;
+}
+
+/* Consumes SYNC_LOOPS integers, checking that they come in order */
+int consumer(void)
+{
+	int ok = 1;
+
+	for (int i = 1; i <= SYNC_LOOPS; i++) {
+		uthread_mutex_lock(sync_mutex);
+		while (buf_len == 0)
+			uthread_cond_wait(not_empty, sync_mutex);
+		ok = ok && buf[buf_head] == i;
+		buf_head = (buf_head + 1) % BUF_SIZE;
+		buf_len--;
+		uthread_cond_signal(not_full);
+		uthread_mutex_unlock(sync_mutex);
+	}
+	return ok;
+}
+
+/**
+ * Tests condition variables
+ * - A producer and a consumer go through a bounded buffer in order
+ * - Waiting requires owning the mutex
+ */
+void test_cond(void)
+{
+	fprintf(stderr, "*** TEST cond ***\n");
+
+	uthread_t prod, cons;
+	int ok = 0;
+
+	uthread_start(0);
+	sync_mutex = uthread_mutex_create();
+	not_empty = uthread_cond_create();
+	not_full = uthread_cond_create();
+	TEST_ASSERT(uthread_cond_wait(not_empty, sync_mutex) == -1);
+	cons = uthread_create(consumer);
+	prod = uthread_create(producer);
+	uthread_join(prod, NULL);
+	uthread_join(cons, &ok);
+	TEST_ASSERT(ok);
+	TEST_ASSERT(uthread_cond_broadcast(not_empty) == 0);
+	TEST_ASSERT(uthread_cond_destroy(not_empty) == 0);
+	TEST_ASSERT(uthread_cond_destroy(not_full) == 0);
+	TEST_ASSERT(uthread_mutex_destroy(sync_mutex) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static uthread_sem_t sem_ping, sem_pong;
+static int sem_trace[6], sem_trace_len;
+
+/* Takes turns with the main thread */
+int pong(void)
+{
+	for (int i = 0; i < 3; i++) {
+		uthread_sem_down(sem_ping);
+		sem_trace[sem_trace_len++] = 2;
+		uthread_sem_up(sem_pong);
+	}
+	return 0;
+}
+
+/**
+ * Tests semaphores
+ * - Two threads take turns, each waking the other up
+ * - Units given in advance are not lost
+ */
+void test_sem(void)
+{
+	fprintf(stderr, "*** TEST sem ***\n");
+
+	uthread_t tid;
+	int ok = 1;
+
+	uthread_start(0);
+	sem_ping = uthread_sem_create(0);
+	sem_pong = uthread_sem_create(0);
+	tid = uthread_create(pong);
+	for (int i = 0; i < 3; i++) {
+		sem_trace[sem_trace_len++] = 1;
+		uthread_sem_up(sem_ping);
+		uthread_sem_down(sem_pong);
+	}
+	uthread_join(tid, NULL);
+	for (int i = 0; i < 6; i++)
+		ok = ok && sem_trace[i] == 1 + i % 2;
+	TEST_ASSERT(ok);
+
+	uthread_sem_up(sem_ping);
+	uthread_sem_up(sem_ping);
+	TEST_ASSERT(uthread_sem_down(sem_ping) == 0 && uthread_sem_down(sem_ping) == 0);
+	TEST_ASSERT(uthread_sem_destroy(sem_ping) == 0);
+	TEST_ASSERT(uthread_sem_destroy(sem_pong) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static uthread_chan_t chan_a, chan_b;
+static int chan_trace[4], chan_trace_len;
+
+static int chan_receiver(void)
+{
+	int elem;
+
+	if (uthread_chan_recv(chan_a, &elem) == -1) elem = -1;
+	chan_trace[chan_trace_len++] = elem;
+	return 0;
+}
+
+#define PIPELINE_LEN 10000
+
+static int pipeline_source(void)
+{
+	for (int i = 1; i <= PIPELINE_LEN; i++)
+		uthread_chan_send(chan_a, &i);
+	uthread_chan_close(chan_a);
+	return 0;
+}
+
+static int pipeline_square(void)
+{
+	long elem;
+	int i;
+
+	while (uthread_chan_recv(chan_a, &i) == 0) {
+		elem = (long)i * i;
+		uthread_chan_send(chan_b, &elem);
+	}
+	uthread_chan_close(chan_b);
+	return 0;
+}
+
+/* Test unbuffered and buffered channels, and closing them */
+void test_chan(void)
+{
+	fprintf(stderr, "*** TEST chan ***\n");
+
+	uthread_opts_t opts;
+	uthread_t tids[2];
+	long elem, sum = 0, expected = 0;
+	int i;
+
+	uthread_start(0);
+	TEST_ASSERT(uthread_chan_create(0, 1) == NULL);
+
+	// A send to a waiting receiver runs the receiver right away
+	chan_a = uthread_chan_create(sizeof(int), 0);
+	tids[0] = uthread_create(chan_receiver);
+	uthread_yield(); // the receiver waits
+	i = 1;
+	TEST_ASSERT(uthread_chan_send(chan_a, &i) == 0);
+	chan_trace[chan_trace_len++] = 2;
+	TEST_ASSERT(chan_trace_len == 2 && chan_trace[0] == 1 && chan_trace[1] == 2);
+	uthread_join(tids[0], NULL);
+
+	// A closed channel wakes its receivers up, which fail
+	tids[0] = uthread_create(chan_receiver);
+	uthread_yield();
+	TEST_ASSERT(uthread_chan_destroy(chan_a) == -1);
+	TEST_ASSERT(uthread_chan_close(chan_a) == 0);
+	TEST_ASSERT(uthread_chan_close(chan_a) == -1);
+	TEST_ASSERT(uthread_chan_send(chan_a, &i) == -1);
+	uthread_join(tids[0], NULL);
+	TEST_ASSERT(chan_trace_len == 3 && chan_trace[2] == -1);
+	TEST_ASSERT(uthread_chan_destroy(chan_a) == 0);
+
+	// Buffered elements come out in order, even once closed
+	chan_a = uthread_chan_create(sizeof(int), 3);
+	for (i = 0; i < 3; i++)
+		uthread_chan_send(chan_a, &i);
+	uthread_chan_close(chan_a);
+	for (int j = 0; j < 3; j++)
+		TEST_ASSERT(uthread_chan_recv(chan_a, &i) == 0 && i == j);
+	TEST_ASSERT(uthread_chan_recv(chan_a, &i) == -1);
+	TEST_ASSERT(uthread_chan_destroy(chan_a) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+
+	// Pipeline through unbuffered and buffered channels, on several workers
+	uthread_opts_init(&opts);
+	opts.nr_workers = 4;
+	opts.preempt = UTHREAD_PREEMPT_ASYNC;
+	opts.quantum_us = 1000;
+	uthread_start_opts(&opts);
+	chan_a = uthread_chan_create(sizeof(int), 0);
+	chan_b = uthread_chan_create(sizeof(long), 16);
+	tids[0] = uthread_create(pipeline_source);
+	tids[1] = uthread_create(pipeline_square);
+	while (uthread_chan_recv(chan_b, &elem) == 0)
+		sum += elem;
+	for (i = 1; i <= PIPELINE_LEN; i++)
+		expected += (long)i * i;
+	TEST_ASSERT(sum == expected);
+	uthread_join(tids[0], NULL);
+	uthread_join(tids[1], NULL);
+	TEST_ASSERT(uthread_chan_destroy(chan_a) == 0);
+	TEST_ASSERT(uthread_chan_destroy(chan_b) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
+static int select_sender(void)
+{
+	int elem = 42;
+
+	uthread_chan_send(chan_b, &elem);
+	return 0;
+}
+
+static int select_receiver(void)
+{
+	int elem;
+
+	uthread_chan_recv(chan_b, &elem);
+	chan_trace[chan_trace_len++] = elem;
+	return 0;
+}
+
+/* Test selecting among several channel operations */
+void test_select(void)
+{
+	fprintf(stderr, "*** TEST select ***\n");
+
+	struct uthread_chan_op ops[3];
+	int in_a = 0, in_b = 0, out = 7, seen_a = 0, seen_b = 0;
+	uthread_t tid;
+
+	uthread_start(0);
+	chan_a = uthread_chan_create(sizeof(int), 4);
+	chan_b = uthread_chan_create(sizeof(int), 0);
+	ops[0] = (struct uthread_chan_op){.chan = chan_a, .dir = UTHREAD_CHAN_RECV, .elem = &in_a};
+	ops[1] = (struct uthread_chan_op){.chan = chan_b, .dir = UTHREAD_CHAN_RECV, .elem = &in_b};
+	ops[2] = (struct uthread_chan_op){.chan = NULL};
+
+	// Null argument and nothing ready tests
+	TEST_ASSERT(uthread_chan_select(NULL, 1, 1) == -1);
+	TEST_ASSERT(uthread_chan_select(&ops[2], 1, 1) == -1);
+	TEST_ASSERT(uthread_chan_select(ops, 3, 0) == -1);
+
+	// Ready operations get their turn
+	for (int i = 0; i < 4; i++)
+		uthread_chan_send(chan_a, &i);
+	ops[1].chan = chan_a;
+	for (int i = 0; i < 4; i++) {
+		int index = uthread_chan_select(ops, 2, 0);
+		seen_a += index == 0;
+		seen_b += index == 1;
+	}
+	TEST_ASSERT(seen_a == 2 && seen_b == 2);
+	TEST_ASSERT(uthread_chan_select(ops, 2, 0) == -1);
+
+	// Block until a sender shows up on either channel
+	ops[1].chan = chan_b;
+	tid = uthread_create(select_sender);
+	TEST_ASSERT(uthread_chan_select(ops, 3, 1) == 1);
+	TEST_ASSERT(in_b == 42 && ops[1].ok == 1);
+	uthread_join(tid, NULL);
+
+	// A waiting sender completes as soon as a receiver comes
+	ops[0] = (struct uthread_chan_op){.chan = chan_b, .dir = UTHREAD_CHAN_SEND, .elem = &out};
+	tid = uthread_create(select_receiver);
+	TEST_ASSERT(uthread_chan_select(ops, 1, 1) == 0 && ops[0].ok == 1);
+	uthread_join(tid, NULL);
+	TEST_ASSERT(chan_trace[chan_trace_len - 1] == 7);
+
+	// Closing completes the operation, without an element
+	uthread_chan_close(chan_a);
+	ops[0] = (struct uthread_chan_op){.chan = chan_a, .dir = UTHREAD_CHAN_RECV, .elem = &in_a};
+	TEST_ASSERT(uthread_chan_select(ops, 1, 1) == 0 && ops[0].ok == 0);
+	TEST_ASSERT(uthread_chan_destroy(chan_a) == 0);
+	TEST_ASSERT(uthread_chan_destroy(chan_b) == 0);
+	TEST_ASSERT(uthread_stop() == 0);
+}
+
 int thread3(void)
 {
 	uthread_yield();
@@ -171,6 +1319,24 @@ int main(void)
 	test_multiple_thr_joining_one();
 	test_one_joining_multiple();
 	test_collect_dead_thr();
+	test_tid_recycling();
+	test_create_attr();
+	test_create_n();
+	test_detach();
+	test_stats();
+	test_trace();
+	test_stack_usage();
+	test_stack_grow();
+	test_mn();
+	test_priority();
+	test_io();
+	test_offload();
+	test_sleep();
+	test_mutex();
+	test_cond();
+	test_sem();
+	test_chan();
+	test_select();
 	test_multiple_thr();
 
 	return 0;
@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <wheel.h>
+
+#define TEST_ASSERT(assert)				\
+do {									\
+	printf("ASSERT: " #assert " ... ");	\
+	if (assert) {						\
+		printf("PASS\n");				\
+	} else	{							\
+		printf("FAIL\n");				\
+		exit(1);						\
+	}									\
+} while(0)
+
+/* Expiration time of the first expired timer, or 0 if none expired */
+static uint64_t first_expired(struct iqueue *expired)
+{
+	struct iqueue_node *node = iqueue_dequeue(expired);
+
+	if (node == NULL) return 0;
+	return iqueue_entry(node, struct wheel_timer, link)->expires;
+}
+
+/* Test creating a wheel */
+void test_create(void)
+{
+	fprintf(stderr, "*** TEST create ***\n");
+
+	wheel_t w = wheel_create(1000);
+	TEST_ASSERT(w != NULL);
+	TEST_ASSERT(wheel_length(w) == 0);
+	TEST_ASSERT(wheel_next(w) == WHEEL_NEVER);
+	TEST_ASSERT(wheel_destroy(w) == 0);
+}
+
+/* Test expiring timers, in order and on time */
+void test_expire(void)
+{
+	fprintf(stderr, "*** TEST expire ***\n");
+
+	struct wheel_timer t1, t2, t3;
+	struct iqueue expired;
+	wheel_t w = wheel_create(0);
+
+	// Null argument tests
+	TEST_ASSERT(wheel_add(NULL, &t1, 10) == -1);
+	TEST_ASSERT(wheel_add(w, NULL, 10) == -1);
+	TEST_ASSERT(wheel_advance(w, 10, NULL) == -1);
+
+	iqueue_init(&expired);
+	wheel_add(w, &t3, 30);
+	wheel_add(w, &t1, 10);
+	wheel_add(w, &t2, 20);
+	TEST_ASSERT(wheel_length(w) == 3);
+	TEST_ASSERT(wheel_next(w) == 10);
+	TEST_ASSERT(wheel_advance(w, 9, &expired) == 0);
+	TEST_ASSERT(wheel_advance(w, 25, &expired) == 2);
+	TEST_ASSERT(first_expired(&expired) == 10);
+	TEST_ASSERT(first_expired(&expired) == 20);
+	TEST_ASSERT(wheel_next(w) == 30);
+	TEST_ASSERT(wheel_advance(w, 30, &expired) == 1);
+	TEST_ASSERT(first_expired(&expired) == 30);
+
+	// A timer already due expires at the next tick
+	wheel_add(w, &t1, 5);
+	TEST_ASSERT(wheel_next(w) == 31);
+	TEST_ASSERT(wheel_advance(w, 31, &expired) == 1);
+	TEST_ASSERT(wheel_length(w) == 0);
+	TEST_ASSERT(wheel_destroy(w) == 0);
+}
+
+/* Test deleting timers before they expire */
+void test_del(void)
+{
+	fprintf(stderr, "*** TEST del ***\n");
+
+	struct wheel_timer t1, t2;
+	struct iqueue expired;
+	wheel_t w = wheel_create(0);
+
+	iqueue_init(&expired);
+	wheel_add(w, &t1, 100000);
+	wheel_add(w, &t2, 50);
+	TEST_ASSERT(wheel_destroy(w) == -1); // timers pending
+	TEST_ASSERT(wheel_del(w, &t1) == 0);
+	TEST_ASSERT(wheel_del(w, &t1) == -1);
+	TEST_ASSERT(wheel_length(w) == 1);
+	TEST_ASSERT(wheel_advance(w, 1000000, &expired) == 1);
+	TEST_ASSERT(first_expired(&expired) == 50);
+	TEST_ASSERT(wheel_del(w, &t2) == -1); // expired
+	TEST_ASSERT(wheel_next(w) == WHEEL_NEVER);
+	TEST_ASSERT(wheel_destroy(w) == 0);
+}
+
+#define NR_TIMERS 10000
+
+/*
+ * Test timers spread over every level, beyond the wheel's range, advanced by
+ * random steps: each timer expires exactly at the first advance reaching its
+ * expiration time
+ */
+void test_cascade(void)
+{
+	fprintf(stderr, "*** TEST cascade ***\n");
+
+	static struct wheel_timer timers[NR_TIMERS];
+	struct iqueue expired;
+	uint64_t now = 12345, prev = now;
+	int nr_expired = 0, ok = 1;
+	wheel_t w = wheel_create(now);
+
+	iqueue_init(&expired);
+	srand(1);
+	for (int i = 0; i < NR_TIMERS; i++) {
+		int bits = rand() % 40; // up to beyond WHEEL_RANGE
+		uint64_t delay = ((uint64_t)rand() << 31 | rand()) & (((uint64_t)1 << bits) - 1);
+		wheel_add(w, &timers[i], now + 1 + delay);
+	}
+	TEST_ASSERT(wheel_length(w) == NR_TIMERS);
+
+	while (wheel_length(w) > 0) {
+		struct iqueue_node *node;
+		uint64_t next = wheel_next(w);
+
+		// Jump right before the next event, or step randomly
+		now = rand() % 2 ? next - 1 : now + rand() % 100000;
+		if (now < prev) now = prev;
+		nr_expired += wheel_advance(w, now, &expired);
+		while ((node = iqueue_dequeue(&expired)) != NULL) {
+			uint64_t expires = iqueue_entry(node, struct wheel_timer, link)->expires;
+			ok = ok && expires > prev && expires <= now;
+		}
+		prev = now;
+		now++;
+		nr_expired += wheel_advance(w, now, &expired);
+		while ((node = iqueue_dequeue(&expired)) != NULL) {
+			uint64_t expires = iqueue_entry(node, struct wheel_timer, link)->expires;
+			ok = ok && expires == now;
+		}
+		prev = now;
+	}
+	TEST_ASSERT(ok);
+	TEST_ASSERT(nr_expired == NR_TIMERS);
+	TEST_ASSERT(wheel_destroy(w) == 0);
+}
+
+int main(void)
+{
+	test_create();
+	test_expire();
+	test_del();
+	test_cascade();
+
+	return 0;
+}
@@ -0,0 +1,344 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iqueue.h"
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Channels
+ *
+ * A channel carries elements of a fixed size through a ring buffer of
+ * @capacity elements, along with FIFOs of blocked senders and receivers. A
+ * thread only waits while the channel cannot serve it: senders while the
+ * buffer is full, receivers while it is empty. Elements are copied straight
+ * between the waiting thread's buffer and its counterpart, so that a receiver
+ * never finds its element in the ring buffer. On an unbuffered channel, a
+ * sender to a waiting receiver also switches to it directly, as it would
+ * otherwise wait for the receiver's next element anyway. On a buffered channel,
+ * the sender keeps running so that it can fill the buffer.
+ *
+ * A blocked thread waits on one or more channels (uthread_chan_select()) with
+ * one waiter per operation, all of them on its stack. The first counterpart
+ * completing one of the operations unlinks all the waiters, so that no other
+ * operation can complete as well. Channels are protected by the scheduler lock.
+ */
+
+struct chan_wait;
+
+struct chan_waiter {
+	struct chan_wait *wait;
+	struct iqueue *queue; // queue of the channel the waiter is linked into
+	void *elem; // element to send, or buffer to receive into
+	struct iqueue_node link;
+};
+
+struct chan_wait {
+	struct tcb *thr;
+	int index; // operation which completed, -1 until then
+	int ok; // 0 if it completed because the channel was closed
+	struct chan_waiter *waiters; // one per operation
+	int nr_waiters;
+};
+
+struct uthread_chan {
+	size_t elem_size;
+	size_t capacity;
+	size_t head; // index of the oldest buffered element
+	size_t count; // number of buffered elements
+	int closed;
+	struct iqueue senders;
+	struct iqueue receivers;
+	char *buffer;
+};
+
+uthread_chan_t uthread_chan_create(size_t elem_size, size_t capacity)
+{
+	uthread_chan_t chan;
+
+	if (elem_size == 0) return NULL;
+	chan = malloc(sizeof(struct uthread_chan));
+	if (chan == NULL) return NULL;
+	chan->buffer = NULL;
+	if (capacity && (chan->buffer = malloc(elem_size * capacity)) == NULL) {
+		free(chan);
+		return NULL;
+	}
+	chan->elem_size = elem_size;
+	chan->capacity = capacity;
+	chan->head = chan->count = 0;
+	chan->closed = 0;
+	iqueue_init(&chan->senders);
+	iqueue_init(&chan->receivers);
+
+	return chan;
+}
+
+int uthread_chan_destroy(uthread_chan_t chan)
+{
+	if (chan == NULL || iqueue_length(&chan->senders)
+	    || iqueue_length(&chan->receivers)) {
+		return -1;
+	}
+
+	free(chan->buffer);
+	free(chan);
+	return 0;
+}
+
+/*
+ * Complete the operation of @waiter, which was just dequeued, and unlink the
+ * other waiters of its thread, the scheduler being locked
+ *
+ * Return: Thread to wake up
+ */
+static struct tcb *chan_fire(struct chan_waiter *waiter, int ok)
+{
+	struct chan_wait *wait = waiter->wait;
+
+	wait->index = waiter - wait->waiters;
+	wait->ok = ok;
+	for (int i = 0; i < wait->nr_waiters; i++) {
+		struct chan_waiter *other = &wait->waiters[i];
+		if (other->link.next) iqueue_delete(other->queue, &other->link);
+	}
+
+	// The waiters live on the thread's stack, which may be gone once woken up
+	return wait->thr;
+}
+
+static struct chan_waiter *chan_waiter_dequeue(struct iqueue *queue)
+{
+	struct iqueue_node *node = iqueue_dequeue(queue);
+
+	return node ? iqueue_entry(node, struct chan_waiter, link) : NULL;
+}
+
+/*
+ * Send @elem to @chan without blocking, the scheduler being locked
+ *
+ * Return: 1 if sent, with the receiver it was copied to in @receiver if any; 0
+ * if @chan cannot take it right now; -1 if @chan is closed
+ */
+static int chan_try_send(uthread_chan_t chan, const void *elem, struct tcb **receiver)
+{
+	struct chan_waiter *waiter;
+
+	*receiver = NULL;
+	if (chan->closed) return -1;
+
+	if ((waiter = chan_waiter_dequeue(&chan->receivers)) != NULL) {
+		// Receivers only wait on an empty buffer
+		memcpy(waiter->elem, elem, chan->elem_size);
+		*receiver = chan_fire(waiter, 1);
+		return 1;
+	}
+	if (chan->count < chan->capacity) {
+		size_t tail = (chan->head + chan->count) % chan->capacity;
+
+		memcpy(chan->buffer + tail * chan->elem_size, elem, chan->elem_size);
+		chan->count++;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Receive an element of @chan into @elem without blocking, the scheduler being
+ * locked, and wake up the sender it frees room for, if any
+ *
+ * Return: 1 if received; 0 if @chan has nothing to receive right now; -1 if
+ * @chan is closed and drained
+ */
+static int chan_try_recv(uthread_chan_t chan, void *elem)
+{
+	struct chan_waiter *waiter = chan_waiter_dequeue(&chan->senders);
+
+	if (chan->count) {
+		memcpy(elem, chan->buffer + chan->head * chan->elem_size, chan->elem_size);
+		chan->head = (chan->head + 1) % chan->capacity;
+		chan->count--;
+		if (waiter) { // the oldest sender takes the freed slot
+			size_t tail = (chan->head + chan->count) % chan->capacity;
+
+			memcpy(chan->buffer + tail * chan->elem_size, waiter->elem, chan->elem_size);
+			chan->count++;
+			uthread_wake(chan_fire(waiter, 1));
+		}
+		return 1;
+	}
+	if (waiter) { // unbuffered
+		memcpy(elem, waiter->elem, chan->elem_size);
+		uthread_wake(chan_fire(waiter, 1));
+		return 1;
+	}
+
+	return chan->closed ? -1 : 0;
+}
+
+/*
+ * Block the calling thread until one of the @wait->nr_waiters operations
+ * registered in @wait completes, the scheduler being locked
+ */
+static void chan_wait(struct chan_wait *wait)
+{
+	wait->thr = uthread_current();
+	wait->index = -1;
+	for (int i = 0; i < wait->nr_waiters; i++) {
+		if (wait->waiters[i].queue == NULL) continue; // no channel
+		iqueue_enqueue(wait->waiters[i].queue, &wait->waiters[i].link);
+	}
+	uthread_block();
+}
+
+int uthread_chan_send(uthread_chan_t chan, const void *elem)
+{
+	struct chan_wait wait;
+	struct chan_waiter waiter;
+	struct tcb *receiver;
+	int ret;
+
+	if (chan == NULL || elem == NULL) return -1;
+
+	uthread_sched_lock();
+	ret = chan_try_send(chan, elem, &receiver);
+	if (receiver && chan->capacity == 0) {
+		uthread_wake_switch(receiver);
+		return 0;
+	}
+	if (receiver) uthread_wake(receiver);
+	if (ret) {
+		uthread_sched_unlock();
+		return ret == 1 ? 0 : -1;
+	}
+
+	waiter = (struct chan_waiter){
+		.wait = &wait,
+		.queue = &chan->senders,
+		.elem = (void *)elem,
+	};
+	wait.waiters = &waiter;
+	wait.nr_waiters = 1;
+	chan_wait(&wait);
+
+	return wait.ok ? 0 : -1;
+}
+
+int uthread_chan_recv(uthread_chan_t chan, void *elem)
+{
+	struct chan_wait wait;
+	struct chan_waiter waiter;
+	int ret;
+
+	if (chan == NULL || elem == NULL) return -1;
+
+	uthread_sched_lock();
+	ret = chan_try_recv(chan, elem);
+	if (ret) {
+		uthread_sched_unlock();
+		return ret == 1 ? 0 : -1;
+	}
+
+	waiter = (struct chan_waiter){
+		.wait = &wait,
+		.queue = &chan->receivers,
+		.elem = elem,
+	};
+	wait.waiters = &waiter;
+	wait.nr_waiters = 1;
+	chan_wait(&wait);
+
+	return wait.ok ? 0 : -1;
+}
+
+int uthread_chan_close(uthread_chan_t chan)
+{
+	struct chan_waiter *waiter;
+
+	if (chan == NULL) return -1;
+
+	uthread_sched_lock();
+	if (chan->closed) {
+		uthread_sched_unlock();
+		return -1;
+	}
+	chan->closed = 1;
+	// Waiting receivers imply an empty buffer, they get nothing more
+	while ((waiter = chan_waiter_dequeue(&chan->receivers)) != NULL)
+		uthread_wake(chan_fire(waiter, 0));
+	while ((waiter = chan_waiter_dequeue(&chan->senders)) != NULL)
+		uthread_wake(chan_fire(waiter, 0));
+	uthread_sched_unlock();
+
+	return 0;
+}
+
+int uthread_chan_select(struct uthread_chan_op *ops, int nr_ops, int block)
+{
+	static unsigned int rotation; // start scanning at a different operation each time
+	struct chan_wait wait;
+	struct chan_waiter waiters[UTHREAD_CHAN_SELECT_MAX];
+	int start, nr_chans = 0;
+
+	if (ops == NULL || nr_ops <= 0 || nr_ops > UTHREAD_CHAN_SELECT_MAX) return -1;
+	for (int i = 0; i < nr_ops; i++) {
+		if (ops[i].chan == NULL) continue; // never ready
+		if (ops[i].elem == NULL
+		    || (ops[i].dir != UTHREAD_CHAN_SEND && ops[i].dir != UTHREAD_CHAN_RECV)) {
+			return -1;
+		}
+		nr_chans++;
+	}
+	if (nr_chans == 0) return -1;
+
+	uthread_sched_lock();
+	// Go through the operations in turn, so that a ready channel listed first
+	// does not starve the others
+	start = rotation++ % nr_ops;
+	for (int n = 0; n < nr_ops; n++) {
+		int i = (start + n) % nr_ops;
+		struct tcb *receiver = NULL;
+		int ret;
+
+		if (ops[i].chan == NULL) continue;
+		if (ops[i].dir == UTHREAD_CHAN_SEND) {
+			ret = chan_try_send(ops[i].chan, ops[i].elem, &receiver);
+		} else {
+			ret = chan_try_recv(ops[i].chan, ops[i].elem);
+		}
+		if (ret == 0) continue;
+
+		ops[i].ok = ret == 1;
+		if (receiver && ops[i].chan->capacity == 0) {
+			uthread_wake_switch(receiver);
+			return i;
+		}
+		if (receiver) uthread_wake(receiver);
+		uthread_sched_unlock();
+		return i;
+	}
+	if (!block) {
+		uthread_sched_unlock();
+		return -1;
+	}
+
+	wait.waiters = waiters;
+	wait.nr_waiters = nr_ops;
+	for (int i = 0; i < nr_ops; i++) {
+		struct uthread_chan *chan = ops[i].chan;
+
+		// Keep the indices of the waiters those of the operations
+		waiters[i] = (struct chan_waiter){
+			.wait = &wait,
+			.queue = chan == NULL ? NULL
+				: ops[i].dir == UTHREAD_CHAN_SEND ? &chan->senders : &chan->receivers,
+			.elem = ops[i].elem,
+		};
+	}
+	chan_wait(&wait);
+
+	ops[wait.index].ok = wait.ok;
+	return wait.index;
+}
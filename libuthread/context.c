@@ -1,12 +1,20 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/* Size of the stack for a thread (in bytes) */
-#define UTHREAD_STACK_SIZE 32768
+/* Default number of freed stacks kept committed for immediate reuse */
+#define UTHREAD_STACK_CACHE 1024
 
+/* Maximum number of freed stacks kept mapped, committed or not */
+#define UTHREAD_STACK_POOL_MAX 16384
+
+#ifdef UTHREAD_CTX_UCONTEXT
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
 	/*
@@ -18,15 +26,337 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 		exit(1);
 	}
 }
+#endif
+
+/*
+ * Stack allocation
+ *
+ * Stacks are mapped with mmap() right above a PROT_NONE guard region, so that
+ * a stack overflow faults instead of silently corrupting the heap. Mappings are
+ * only reserved: pages get committed as the thread touches them, so a large
+ * stack only costs what is actually used.
+ *
+ * Stacks of the default geometry (size, growth limit and guard) which did not
+ * grow are not unmapped when freed but kept in a pool made of two free lists:
+ * - the hot list holds up to @stack_cache stacks, with their pages untouched
+ * - the cold list holds the extra ones, up to UTHREAD_STACK_POOL_MAX in total,
+ *   whose pages are returned to the kernel (except for the topmost one, which
+ *   holds the free list link and is the first to be touched again)
+ * Allocation reuses hot stacks first, then cold ones, and only maps new stacks
+ * when both lists are empty.
+ */
+struct stack_link {
+	struct stack_link *next;
+};
+
+static struct stack_link *hot_stacks, *cold_stacks;
+static unsigned int nr_hot_stacks, nr_cold_stacks;
+static unsigned int stack_cache = UTHREAD_STACK_CACHE;
+static size_t page_size;
+
+static size_t page_round_up(size_t size)
+{
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/* Whether @stack has the geometry of the stacks managed by the pool */
+static int stack_is_pooled(const uthread_stack_t *stack)
+{
+	return stack->size == UTHREAD_STACK_SIZE && stack->max == UTHREAD_STACK_MAX
+		&& stack->guard == page_size;
+}
+
+/* Free list link of a pooled stack, stored at its very top */
+static struct stack_link *stack_to_link(void *base)
+{
+	return (struct stack_link *)((char *)base + UTHREAD_STACK_SIZE) - 1;
+}
+
+static void *link_to_stack(struct stack_link *link)
+{
+	return (char *)(link + 1) - UTHREAD_STACK_SIZE;
+}
+
+static void *stack_map(size_t size, size_t max, size_t guard)
+{
+	size_t reserve = guard + max - size;
+	char *map;
+
+	map = mmap(NULL, guard + max, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	// Guard region at the lowest address, stacks grow down towards it through
+	// the part they may grow into
+	if (reserve && mprotect(map, reserve, PROT_NONE)) {
+		munmap(map, guard + max);
+		return NULL;
+	}
+
+	return map + reserve;
+}
 
-void *uthread_ctx_alloc_stack(void)
+static void stack_unmap(const uthread_stack_t *stack)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+	char *top = (char *)stack->base + stack->size;
+
+	munmap(top - stack->max - stack->guard, stack->guard + stack->max);
 }
 
-void uthread_ctx_destroy_stack(void *top_of_stack)
+/* Return the memory of an idle pooled stack but its topmost page */
+static void stack_decommit(void *base)
 {
-	free(top_of_stack);
+#ifdef MADV_FREE
+	if (madvise(base, UTHREAD_STACK_SIZE - page_size, MADV_FREE) == 0)
+		return;
+#endif
+	// MADV_FREE is not supported by older kernels
+	madvise(base, UTHREAD_STACK_SIZE - page_size, MADV_DONTNEED);
+}
+
+static void *stack_pop(struct stack_link **list, unsigned int *nr)
+{
+	struct stack_link *link = *list;
+
+	if (link == NULL)
+		return NULL;
+
+	*list = link->next;
+	(*nr)--;
+	return link_to_stack(link);
+}
+
+static void stack_push(struct stack_link **list, unsigned int *nr, void *base)
+{
+	struct stack_link *link = stack_to_link(base);
+
+	link->next = *list;
+	*list = link;
+	(*nr)++;
+}
+
+/*
+ * Stack painting
+ *
+ * While painting is on, new stacks are filled with STACK_PAINT before the
+ * thread starts. As stacks grow down, the lowest byte which no longer holds the
+ * paint marks the deepest the thread went so far (unless it happened to write
+ * the paint's value there). Painting touches the whole stack, which forfeits
+ * committing stack pages lazily: it is meant for sizing stacks, not for
+ * production.
+ */
+#define STACK_PAINT 0xa5
+#define STACK_PAINT_WORD 0xa5a5a5a5a5a5a5a5ull
+
+static int stack_paint;
+static unsigned long stack_hist[UTHREAD_STACK_HIST_BUCKETS];
+
+static void stack_paint_init(uthread_stack_t *stack)
+{
+	stack->painted = stack_paint;
+	if (stack_paint)
+		memset(stack->base, STACK_PAINT, stack->size);
+}
+
+/*
+ * Growable stacks
+ *
+ * A growable stack reserves @max bytes but starts with only its top @size bytes
+ * accessible, the rest being PROT_NONE like the guard region below it. When
+ * the thread faults in there, the worker's SIGSEGV handler makes the stack
+ * accessible down to the fault, at least doubling it, until it reaches @max.
+ * Faults below that hit the guard region and are fatal like on fixed stacks.
+ */
+int uthread_ctx_stack_grow(uthread_stack_t *stack, void *addr, size_t below)
+{
+	char *top = (char *)stack->base + stack->size;
+	char *limit = top - stack->max; // lowest address it may grow down to
+	char *want = addr, *base;
+	size_t size;
+
+	if (stack->base == NULL || want < limit || want >= top)
+		return -1;
+	want = (size_t)(want - limit) > below ? want - below : limit;
+	if (want >= (char *)stack->base) // accessible already
+		return -1;
+
+	size = stack->size * 2 < stack->max ? stack->size * 2 : stack->max;
+	base = (char *)((uintptr_t)want & ~(uintptr_t)(page_size - 1));
+	if (base < top - size)
+		size = top - base;
+	base = top - size;
+
+	if (mprotect(base, (char *)stack->base - base, PROT_READ | PROT_WRITE))
+		return -1;
+	// Keep the high-water mark accurate for the part grown into
+	if (stack->painted)
+		memset(base, STACK_PAINT, (char *)stack->base - base);
+	stack->base = base;
+	stack->size = size;
+
+	return 0;
+}
+
+void uthread_set_stack_paint(int enable)
+{
+	uthread_sched_lock();
+	if (enable && !stack_paint)
+		memset(stack_hist, 0, sizeof(stack_hist));
+	stack_paint = !!enable;
+	uthread_sched_unlock();
+}
+
+long uthread_ctx_stack_usage(const uthread_stack_t *stack)
+{
+	const char *end = (const char *)stack->base + stack->size;
+	const uint64_t *word = stack->base;
+	const unsigned char *byte;
+
+	if (stack->base == NULL || !stack->painted)
+		return -1;
+
+	// Stacks are page-aligned: skip the untouched words first
+	while ((const char *)word < end && *word == STACK_PAINT_WORD)
+		word++;
+	byte = (const unsigned char *)word;
+	while ((const char *)byte < end && *byte == STACK_PAINT)
+		byte++;
+
+	return end - (const char *)byte;
+}
+
+void uthread_ctx_stack_record(const uthread_stack_t *stack)
+{
+	long used = uthread_ctx_stack_usage(stack);
+	int i = 0;
+
+	if (used < 0)
+		return;
+	while (i < UTHREAD_STACK_HIST_BUCKETS - 1 && used > (1024l << i))
+		i++;
+	stack_hist[i]++;
+}
+
+int uthread_stack_histogram(unsigned long hist[UTHREAD_STACK_HIST_BUCKETS])
+{
+	if (hist == NULL) return -1;
+
+	uthread_sched_lock();
+	memcpy(hist, stack_hist, sizeof(stack_hist));
+	uthread_sched_unlock();
+	return 0;
+}
+
+void uthread_set_stack_cache(unsigned int nr_stacks)
+{
+	void *base;
+
+	uthread_sched_lock();
+	stack_cache = nr_stacks;
+
+	// Decommit the hot stacks which no longer fit in the cache
+	while (nr_hot_stacks > stack_cache) {
+		base = stack_pop(&hot_stacks, &nr_hot_stacks);
+		stack_decommit(base);
+		stack_push(&cold_stacks, &nr_cold_stacks, base);
+	}
+	uthread_sched_unlock();
+}
+
+int uthread_ctx_alloc_stack(uthread_stack_t *stack, size_t size, size_t max, size_t guard)
+{
+	stack->size = page_round_up(size < UTHREAD_STACK_MIN ? UTHREAD_STACK_MIN : size);
+	stack->max = max > stack->size ? page_round_up(max) : stack->size;
+	stack->guard = page_round_up(guard);
+	stack->base = NULL;
+
+	if (stack_is_pooled(stack)) {
+		stack->base = stack_pop(&hot_stacks, &nr_hot_stacks);
+		if (stack->base == NULL)
+			stack->base = stack_pop(&cold_stacks, &nr_cold_stacks);
+	}
+	if (stack->base == NULL)
+		stack->base = stack_map(stack->size, stack->max, stack->guard);
+	if (stack->base == NULL)
+		return -1;
+	stack_paint_init(stack);
+
+	return 0;
+}
+
+int uthread_ctx_alloc_stacks(uthread_stack_t *stacks, int n, size_t size, size_t max,
+			     size_t guard)
+{
+	size_t span, reserve;
+	char *map;
+	int i; // stacks[0, i) are allocated
+
+	size = page_round_up(size < UTHREAD_STACK_MIN ? UTHREAD_STACK_MIN : size);
+	max = max > size ? page_round_up(max) : size;
+	guard = page_round_up(guard);
+	span = guard + max;
+	reserve = guard + max - size;
+	for (i = 0; i < n; i++) {
+		stacks[i].size = size;
+		stacks[i].max = max;
+		stacks[i].guard = guard;
+		stacks[i].base = NULL;
+	}
+
+	// Reuse pooled stacks first
+	for (i = 0; i < n && stack_is_pooled(&stacks[i]); i++) {
+		stacks[i].base = stack_pop(&hot_stacks, &nr_hot_stacks);
+		if (stacks[i].base == NULL)
+			stacks[i].base = stack_pop(&cold_stacks, &nr_cold_stacks);
+		if (stacks[i].base == NULL) break;
+		stack_paint_init(&stacks[i]);
+	}
+	if (i == n)
+		return 0;
+
+	// Map the other ones as a single region, which can still be unmapped
+	// one stack at a time
+	map = mmap(NULL, (n - i) * span, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+	for (; i < n; i++, map += span) {
+		if (reserve && mprotect(map, reserve, PROT_NONE)) {
+			munmap(map, (n - i) * span);
+			goto fail;
+		}
+		stacks[i].base = map + reserve;
+		stack_paint_init(&stacks[i]);
+	}
+
+	return 0;
+
+fail:
+	while (i-- > 0)
+		uthread_ctx_destroy_stack(&stacks[i]);
+	return -1;
+}
+
+void uthread_ctx_destroy_stack(uthread_stack_t *stack)
+{
+	if (stack->base == NULL)
+		return;
+
+	if (!stack_is_pooled(stack)) {
+		stack_unmap(stack);
+	} else if (nr_hot_stacks < stack_cache) {
+		stack_push(&hot_stacks, &nr_hot_stacks, stack->base);
+	} else if (nr_hot_stacks + nr_cold_stacks < UTHREAD_STACK_POOL_MAX) {
+		stack_decommit(stack->base);
+		stack_push(&cold_stacks, &nr_cold_stacks, stack->base);
+	} else {
+		stack_unmap(stack);
+	}
+	stack->base = NULL;
 }
 
 /*
@@ -35,16 +365,12 @@ void uthread_ctx_destroy_stack(void *top_of_stack)
  */
 static void uthread_ctx_bootstrap(uthread_func_t func)
 {
-	/*
-	 * Enable interrupts right after being elected to run for the first time
-	 */
-	preempt_enable();
-
 	/* Execute thread and when done, exit with the return value */
 	uthread_exit(func());
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+#ifdef UTHREAD_CTX_UCONTEXT
+int uthread_ctx_init(uthread_ctx_t *uctx, const uthread_stack_t *stack,
 		     uthread_func_t func)
 {
 	/*
@@ -56,8 +382,8 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	/*
 	 * Change context @uctx's stack to the specified stack
 	 */
-	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc_stack.ss_sp = stack->base;
+	uctx->uc_stack.ss_size = stack->size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -69,4 +395,35 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 
 	return 0;
 }
+#else
+/* Entry point of new contexts, defined in context_x86_64.S */
+void uthread_ctx_trampoline(void);
+
+/* Default MXCSR (all exceptions masked) and x87 control word */
+#define CTX_INIT_FPU ((uint64_t)0x037f << 32 | 0x1f80)
+
+int uthread_ctx_init(uthread_ctx_t *uctx, const uthread_stack_t *stack,
+		     uthread_func_t func)
+{
+	/*
+	 * Forge the frame that uthread_ctx_switch() pops when resuming @uctx for
+	 * the first time, so that it "returns" into uthread_ctx_trampoline()
+	 * with a 16-byte aligned stack, which then calls
+	 * uthread_ctx_bootstrap(@func)
+	 */
+	uintptr_t top = ((uintptr_t)stack->base + stack->size) & ~(uintptr_t)15;
+	uint64_t *frame = (uint64_t *)(top - 16) - 8;
 
+	frame[0] = CTX_INIT_FPU;
+	frame[1] = 0; /* r15 */
+	frame[2] = 0; /* r14 */
+	frame[3] = (uintptr_t)uthread_ctx_bootstrap; /* r13 */
+	frame[4] = (uintptr_t)func; /* r12 */
+	frame[5] = 0; /* rbx */
+	frame[6] = 0; /* rbp */
+	frame[7] = (uintptr_t)uthread_ctx_trampoline; /* rip */
+	uctx->sp = frame;
+
+	return 0;
+}
+#endif
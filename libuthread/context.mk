@@ -0,0 +1,18 @@
+# Context switch backend, shared by the library and the applications including
+# its private header
+#
+# `make CTX=asm` selects the hand-written x86-64 switch (default on x86-64),
+# `make CTX=ucontext` selects the portable getcontext()/swapcontext() one.
+ifneq ($(filter x86_64-%,$(shell $(CC) -dumpmachine)),)
+CTX ?= asm
+else
+CTX ?= ucontext
+endif
+
+ifeq ($(CTX),ucontext)
+CTX_CFLAGS := -DUTHREAD_CTX_UCONTEXT
+else ifeq ($(CTX),asm)
+CTX_CFLAGS :=
+else
+$(error Unknown context backend CTX=$(CTX), expected asm or ucontext)
+endif
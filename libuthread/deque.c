@@ -0,0 +1,188 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "deque.h"
+
+/*
+ * Chase-Lev work-stealing deque
+ *
+ * Items live in a circular array indexed by two ever-increasing counters: the
+ * owner pushes and pops at @bottom, and thieves take items at @top by bumping
+ * it with a compare-and-swap. Only the last item can be contended between the
+ * owner and thieves, in which case the owner also races for @top.
+ *
+ * Memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (Lê et al., PPoPP 2013). When the owner grows the array, thieves may
+ * still be reading the old one, so retired arrays are only freed along with
+ * the deque. As each array is twice the size of the previous one, this at most
+ * doubles the memory footprint.
+ */
+
+#define DEQUE_INIT_CAPACITY 16
+#define CACHE_LINE 64
+
+struct deque_array {
+	long mask; // capacity - 1
+	struct deque_array *retired; // previous, smaller array
+	_Atomic(void *) items[];
+};
+
+struct deque {
+	// Owner and thieves write different counters, keep them apart
+	_Alignas(CACHE_LINE) atomic_long top;
+	_Alignas(CACHE_LINE) atomic_long bottom;
+	_Atomic(struct deque_array *) array;
+};
+
+static struct deque_array *deque_array_create(long capacity)
+{
+	struct deque_array *array;
+
+	array = malloc(sizeof(*array) + capacity * sizeof(array->items[0]));
+	if (!array) return NULL;
+	array->mask = capacity - 1;
+	array->retired = NULL;
+
+	return array;
+}
+
+/* Double the capacity of @deque, whose items are between @top and @bottom */
+static struct deque_array *deque_grow(deque_t deque, struct deque_array *array,
+				      long top, long bottom)
+{
+	struct deque_array *new_array = deque_array_create(2 * (array->mask + 1));
+	if (!new_array) return NULL;
+
+	for (long i = top; i < bottom; i++) {
+		void *item = atomic_load_explicit(&array->items[i & array->mask],
+						  memory_order_relaxed);
+		atomic_store_explicit(&new_array->items[i & new_array->mask], item,
+				      memory_order_relaxed);
+	}
+	new_array->retired = array;
+	atomic_store_explicit(&deque->array, new_array, memory_order_release);
+
+	return new_array;
+}
+
+deque_t deque_create(void)
+{
+	deque_t new_deque = aligned_alloc(CACHE_LINE, sizeof(struct deque));
+	if (!new_deque) return NULL;
+
+	struct deque_array *array = deque_array_create(DEQUE_INIT_CAPACITY);
+	if (!array) {
+		free(new_deque);
+		return NULL;
+	}
+
+	atomic_init(&new_deque->top, 0);
+	atomic_init(&new_deque->bottom, 0);
+	atomic_init(&new_deque->array, array);
+
+	return new_deque;
+}
+
+int deque_destroy(deque_t deque)
+{
+	if (!deque || deque_length(deque) != 0) return -1;
+
+	struct deque_array *array = atomic_load(&deque->array);
+	while (array) {
+		struct deque_array *retired = array->retired;
+		free(array);
+		array = retired;
+	}
+	free(deque);
+
+	return 0;
+}
+
+int deque_push(deque_t deque, void *data)
+{
+	if (!deque || !data) return -1;
+
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	struct deque_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+	if (bottom - top > array->mask) { // full
+		array = deque_grow(deque, array, top, bottom);
+		if (!array) return -1;
+	}
+
+	atomic_store_explicit(&array->items[bottom & array->mask], data,
+			      memory_order_relaxed);
+	// Publish the item before thieves can see the new bottom
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+	return 0;
+}
+
+int deque_pop(deque_t deque, void **data)
+{
+	if (!deque || !data) return -1;
+
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	struct deque_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+	// Reserve the bottom item before looking at what thieves took
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top > bottom) { // empty
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return -1;
+	}
+
+	void *item = atomic_load_explicit(&array->items[bottom & array->mask],
+					  memory_order_relaxed);
+	if (top == bottom) {
+		// Last item: race the thieves for it
+		int won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+								  memory_order_seq_cst,
+								  memory_order_relaxed);
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		if (!won) return -1;
+	}
+
+	*data = item;
+	return 0;
+}
+
+int deque_steal(deque_t deque, void **data)
+{
+	if (!deque || !data) return -1;
+
+	for (;;) {
+		long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+		if (top >= bottom) return -1; // empty
+
+		struct deque_array *array = atomic_load_explicit(&deque->array,
+								 memory_order_acquire);
+		void *item = atomic_load_explicit(&array->items[top & array->mask],
+						  memory_order_relaxed);
+		if (atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+							    memory_order_seq_cst,
+							    memory_order_relaxed)) {
+			*data = item;
+			return 0;
+		}
+		// Lost the race to another thief or to the owner, try again
+	}
+}
+
+int deque_length(deque_t deque)
+{
+	if (!deque) return -1;
+
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+	return bottom > top ? (int)(bottom - top) : 0;
+}
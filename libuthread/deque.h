@@ -0,0 +1,82 @@
+#ifndef _DEQUE_H
+#define _DEQUE_H
+
+/*
+ * deque_t - Work-stealing deque type
+ *
+ * A work-stealing deque is a double-ended queue with one owner and any number
+ * of thieves. The owner pushes and pops data items at the bottom end, in LIFO
+ * order, while thieves concurrently steal the oldest items from the top end.
+ *
+ * This is a lock-free Chase-Lev deque: all operations are O(1), except for a
+ * push which finds the deque full and doubles its capacity. deque_push() and
+ * deque_pop() must only ever be called by the owner; deque_steal() and
+ * deque_length() can be called from any thread.
+ */
+typedef struct deque* deque_t;
+
+/*
+ * deque_create - Allocate an empty deque
+ *
+ * Create a new object of type 'struct deque' and return its address.
+ *
+ * Return: Pointer to new empty deque. NULL in case of failure when allocating
+ * the new deque.
+ */
+deque_t deque_create(void);
+
+/*
+ * deque_destroy - Deallocate a deque
+ * @deque: Deque to deallocate
+ *
+ * Deallocate the memory associated to the deque object pointed by @deque. No
+ * thief may access @deque anymore.
+ *
+ * Return: -1 if @deque is NULL or if @deque is not empty. 0 if @deque was
+ * successfully destroyed.
+ */
+int deque_destroy(deque_t deque);
+
+/*
+ * deque_push - Push data item at the bottom (owner only)
+ * @deque: Deque in which to push item
+ * @data: Address of data item to push
+ *
+ * Return: -1 if @deque or @data are NULL, or in case of memory allocation error
+ * when growing the deque. 0 if @data was successfully pushed in @deque.
+ */
+int deque_push(deque_t deque, void *data);
+
+/*
+ * deque_pop - Pop the newest data item from the bottom (owner only)
+ * @deque: Deque in which to pop item
+ * @data: Address of data pointer where item is received
+ *
+ * Return: -1 if @deque or @data are NULL, or if the deque is empty (which
+ * includes losing the race for its last item to a thief). 0 if @data was set
+ * with the newest item available in @deque.
+ */
+int deque_pop(deque_t deque, void **data);
+
+/*
+ * deque_steal - Steal the oldest data item from the top
+ * @deque: Deque from which to steal item
+ * @data: Address of data pointer where item is received
+ *
+ * Return: -1 if @deque or @data are NULL, or if the deque is empty. 0 if @data
+ * was set with the oldest item available in @deque.
+ */
+int deque_steal(deque_t deque, void **data);
+
+/*
+ * deque_length - Deque length
+ * @deque: Deque to get the length of
+ *
+ * Return the number of data items in the deque. When thieves or the owner
+ * operate concurrently, this is only a snapshot.
+ *
+ * Return: Length of @deque, or -1 if @deque is NULL
+ */
+int deque_length(deque_t deque);
+
+#endif /* _DEQUE_H */
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Non-blocking I/O
+ *
+ * The wrappers perform the system call on the (non-blocking) file descriptor
+ * and, if it would block, park the calling thread until the descriptor becomes
+ * ready. Descriptors are registered once with an epoll instance, in
+ * edge-triggered mode for both directions, and each one has a reader and a
+ * writer wait slot. A slot holds the thread waiting for that direction, or
+ * IO_READY when readiness was reported while no thread was waiting yet (the
+ * edge would be lost otherwise).
+ *
+ * The slots are protected by the scheduler lock, which a waiting thread holds
+ * until it is fully switched out, so that a wakeup can never be missed.
+ */
+
+#define IO_READY ((struct tcb *)1)
+#define IO_MAX_EVENTS 256
+#define IO_FDS_INIT_SIZE 64
+
+struct io_fd {
+	int registered;
+	struct tcb *reader;
+	struct tcb *writer;
+};
+
+static int epoll_fd = -1;
+static int wake_fd = -1; // eventfd interrupting a blocked io_poll()
+static struct io_fd *io_fds; // indexed by file descriptor
+static int nr_io_fds;
+static atomic_int nr_io_waiters;
+
+int io_start(void)
+{
+	struct epoll_event ev = {.events = EPOLLIN};
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) return -1;
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ev.data.fd = wake_fd;
+	if (wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1) {
+		io_stop();
+		return -1;
+	}
+	// The nearest sleeping thread's deadline also ends a blocking poll
+	ev.data.fd = sleep_fd();
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+		io_stop();
+		return -1;
+	}
+	atomic_store(&nr_io_waiters, 0);
+
+	return 0;
+}
+
+void io_stop(void)
+{
+	if (wake_fd != -1) close(wake_fd);
+	if (epoll_fd != -1) close(epoll_fd);
+	wake_fd = epoll_fd = -1;
+	free(io_fds);
+	io_fds = NULL;
+	nr_io_fds = 0;
+}
+
+int io_waiting(void)
+{
+	return atomic_load(&nr_io_waiters) > 0 || offload_waiting() || sleep_waiting();
+}
+
+void io_interrupt(void)
+{
+	uint64_t one = 1;
+
+	if (write(wake_fd, &one, sizeof(one)) == -1) {
+		// The counter is already non-zero, the poller gets interrupted anyway
+	}
+}
+
+/* Report readiness to a wait slot, waking its thread if any */
+static int io_ready(struct tcb **slot)
+{
+	if (*slot == NULL || *slot == IO_READY) {
+		*slot = IO_READY;
+		return 0;
+	}
+
+	uthread_wake(*slot);
+	*slot = NULL;
+	atomic_fetch_sub(&nr_io_waiters, 1);
+	return 1;
+}
+
+int io_poll(int timeout)
+{
+	struct epoll_event events[IO_MAX_EVENTS];
+	int nr_events, woken = 0;
+	int saved_errno = errno; // may be polling on behalf of a preempted thread
+
+	nr_events = epoll_wait(epoll_fd, events, IO_MAX_EVENTS, timeout);
+	errno = saved_errno;
+	if (nr_events <= 0) return 0;
+
+	uthread_sched_lock();
+	for (int i = 0; i < nr_events; i++) {
+		int fd = events[i].data.fd;
+		uint32_t ev = events[i].events;
+
+		if (fd == wake_fd) {
+			uint64_t count;
+			if (read(wake_fd, &count, sizeof(count)) == -1) {
+				// Already drained by another poller
+			}
+			offload_reap(); // interrupted by a completed offloaded call?
+			continue;
+		}
+		if (fd == sleep_fd()) {
+			sleep_expire();
+			continue;
+		}
+		if (fd >= nr_io_fds) continue;
+		if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			woken += io_ready(&io_fds[fd].reader);
+		}
+		if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			woken += io_ready(&io_fds[fd].writer);
+		}
+	}
+	uthread_sched_unlock();
+	errno = saved_errno;
+
+	return woken;
+}
+
+/* Make room for descriptor @fd in the table, the scheduler being locked */
+static int io_fds_grow(int fd)
+{
+	int size = nr_io_fds ? nr_io_fds : IO_FDS_INIT_SIZE;
+	struct io_fd *table;
+
+	while (size <= fd)
+		size *= 2;
+	table = realloc(io_fds, size * sizeof(*table));
+	if (table == NULL) return -1;
+	memset(table + nr_io_fds, 0, (size - nr_io_fds) * sizeof(*table));
+	io_fds = table;
+	nr_io_fds = size;
+
+	return 0;
+}
+
+/*
+ * Block the calling thread until @fd is ready for writing if @write, or for
+ * reading otherwise
+ */
+static int io_wait(int fd, int write)
+{
+	struct io_fd *f;
+	struct tcb **slot;
+
+	uthread_sched_lock();
+	if (fd >= nr_io_fds && io_fds_grow(fd) == -1) {
+		uthread_sched_unlock();
+		errno = ENOMEM;
+		return -1;
+	}
+
+	f = &io_fds[fd];
+	if (!f->registered) {
+		// The current readiness gets reported right after being registered
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+			.data.fd = fd,
+		};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			uthread_sched_unlock();
+			return -1;
+		}
+		f->registered = 1;
+	}
+
+	slot = write ? &f->writer : &f->reader;
+	if (*slot == IO_READY) { // ready in the meantime, try again
+		*slot = NULL;
+		uthread_sched_unlock();
+		return 0;
+	}
+	if (*slot != NULL) { // another thread is already waiting
+		uthread_sched_unlock();
+		errno = EBUSY;
+		return -1;
+	}
+
+	*slot = uthread_current();
+	atomic_fetch_add(&nr_io_waiters, 1);
+	uthread_block();
+
+	return 0;
+}
+
+/* Whether the last system call failed because it would have blocked */
+static int would_block(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+ssize_t uthread_read(int fd, void *buf, size_t count)
+{
+	for (;;) {
+		ssize_t ret = read(fd, buf, count);
+		if (ret >= 0 || !would_block()) return ret;
+		if (io_wait(fd, 0) == -1) return -1;
+	}
+}
+
+ssize_t uthread_write(int fd, const void *buf, size_t count)
+{
+	for (;;) {
+		ssize_t ret = write(fd, buf, count);
+		if (ret >= 0 || !would_block()) return ret;
+		if (io_wait(fd, 1) == -1) return -1;
+	}
+}
+
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	for (;;) {
+		int fd = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd >= 0 || !would_block()) return fd;
+		if (io_wait(sockfd, 0) == -1) return -1;
+	}
+}
+
+int uthread_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	if (connect(sockfd, addr, addrlen) == 0) return 0;
+	if (errno != EINPROGRESS) return -1;
+
+	// The connection completes asynchronously, wait for its outcome
+	for (;;) {
+		struct sockaddr_storage peer;
+		socklen_t len;
+		int err;
+
+		if (io_wait(sockfd, 1) == -1) return -1;
+		len = sizeof(err);
+		if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) return -1;
+		if (err) {
+			errno = err;
+			return -1;
+		}
+		len = sizeof(peer);
+		if (getpeername(sockfd, (struct sockaddr *)&peer, &len) == 0) return 0;
+		if (errno != ENOTCONN) return -1; // else stale readiness, still connecting
+	}
+}
+
+int uthread_close(int fd)
+{
+	uthread_sched_lock();
+	if (fd >= 0 && fd < nr_io_fds) {
+		struct io_fd *f = &io_fds[fd];
+
+		// Threads still waiting on @fd get to see it closed
+		if (f->reader && f->reader != IO_READY) io_ready(&f->reader);
+		if (f->writer && f->writer != IO_READY) io_ready(&f->writer);
+		memset(f, 0, sizeof(*f));
+	}
+	uthread_sched_unlock();
+
+	return close(fd);
+}
@@ -0,0 +1,128 @@
+#ifndef _IQUEUE_H
+#define _IQUEUE_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * provides an intrusive FIFO queue: instead of allocating a node for every
+ * enqueued item (as queue_t does), the links live inside the queued object
+ * itself. Enqueueing, dequeueing and deleting therefore never allocate, which
+ * makes these operations safe to use on the context switch path and from the
+ * preemption signal handler.
+ *
+ * An object can be linked into at most one intrusive queue at a time per
+ * embedded struct iqueue_node.
+ */
+
+#include <stddef.h>
+
+/*
+ * struct iqueue_node - Intrusive queue link
+ *
+ * To be embedded in the structure of the objects that get queued. A node which
+ * is not linked into any queue has both of its pointers set to NULL.
+ */
+struct iqueue_node {
+	struct iqueue_node *prev;
+	struct iqueue_node *next;
+};
+
+/*
+ * struct iqueue - Intrusive queue
+ *
+ * Circular doubly linked list with a sentinel @head, so that no operation has
+ * to special-case the first or last item.
+ */
+struct iqueue {
+	struct iqueue_node head;
+	int length;
+};
+
+/*
+ * iqueue_entry - Get the object containing a queue link
+ * @node: Pointer to the struct iqueue_node embedded in the object
+ * @type: Type of the containing object
+ * @member: Name of the struct iqueue_node member within @type
+ */
+#define iqueue_entry(node, type, member) \
+	((type *)((char *)(node) - offsetof(type, member)))
+
+/*
+ * iqueue_init - Initialize an empty queue
+ * @queue: Queue to initialize
+ */
+static inline void iqueue_init(struct iqueue *queue)
+{
+	queue->head.prev = queue->head.next = &queue->head;
+	queue->length = 0;
+}
+
+/*
+ * iqueue_length - Queue length
+ * @queue: Queue to get the length of
+ */
+static inline int iqueue_length(const struct iqueue *queue)
+{
+	return queue->length;
+}
+
+/*
+ * iqueue_enqueue - Enqueue item at the tail of the queue
+ * @queue: Queue in which to enqueue item
+ * @node: Link of the item to enqueue, must not currently be in any queue
+ */
+static inline void iqueue_enqueue(struct iqueue *queue, struct iqueue_node *node)
+{
+	struct iqueue_node *tail = queue->head.prev;
+
+	node->prev = tail;
+	node->next = &queue->head;
+	tail->next = node;
+	queue->head.prev = node;
+	queue->length++;
+}
+
+/*
+ * iqueue_delete - Unlink item from the queue
+ * @queue: Queue the item currently belongs to
+ * @node: Link of the item to remove
+ *
+ * Unlike queue_delete(), this is O(1) since the item knows its neighbours.
+ */
+static inline void iqueue_delete(struct iqueue *queue, struct iqueue_node *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = node->next = NULL;
+	queue->length--;
+}
+
+/*
+ * iqueue_dequeue - Dequeue the oldest item
+ * @queue: Queue in which to dequeue item
+ *
+ * Return: Link of the oldest item, or NULL if @queue is empty
+ */
+static inline struct iqueue_node *iqueue_dequeue(struct iqueue *queue)
+{
+	struct iqueue_node *node = queue->head.next;
+
+	if (node == &queue->head)
+		return NULL;
+
+	iqueue_delete(queue, node);
+	return node;
+}
+
+/*
+ * iqueue_for_each - Iterate over the links of a queue, from oldest to newest
+ * @pos: struct iqueue_node pointer used as the cursor
+ * @tmp: struct iqueue_node pointer used as temporary storage, so that @pos can
+ *	be deleted from the queue as part of the iteration
+ * @queue: Queue to iterate through
+ */
+#define iqueue_for_each(pos, tmp, queue) \
+	for ((pos) = (queue)->head.next, (tmp) = (pos)->next; \
+	     (pos) != &(queue)->head; \
+	     (pos) = (tmp), (tmp) = (pos)->next)
+
+#endif /* _IQUEUE_H */
@@ -0,0 +1,160 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "iqueue.h"
+#include "private.h"
+#include "uthread.h"
+
+/*
+ * Offload pool
+ *
+ * Calls which cannot be made non-blocking run on helper kernel threads, while
+ * the calling thread is blocked. Helpers are started on demand, when a request
+ * finds them all busy, up to OFFLOAD_MAX_THREADS. A completed request is moved
+ * to the done queue and the I/O poller is interrupted, which reaps the done
+ * queue and wakes the requesting threads up.
+ */
+
+#define OFFLOAD_MAX_THREADS 4
+
+struct offload_req {
+	uthread_offload_func_t func;
+	void *arg;
+	void *result;
+	int error; // errno as left by @func
+	struct tcb *waiter;
+	struct iqueue_node link;
+};
+
+static pthread_mutex_t offload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t offload_cond = PTHREAD_COND_INITIALIZER;
+static struct iqueue offload_todo; // requests not picked up by a helper yet
+static struct iqueue offload_done; // completed requests, to be reaped
+static pthread_t offload_threads[OFFLOAD_MAX_THREADS];
+static int nr_offload_threads;
+static int nr_offload_idle; // helpers waiting for a request
+static int offload_stopping;
+static atomic_int nr_offload_pending; // requests whose thread is still blocked
+
+static void *offload_main(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&offload_mutex);
+	for (;;) {
+		struct iqueue_node *node;
+		struct offload_req *req;
+
+		while ((node = iqueue_dequeue(&offload_todo)) == NULL && !offload_stopping) {
+			nr_offload_idle++;
+			pthread_cond_wait(&offload_cond, &offload_mutex);
+			nr_offload_idle--;
+		}
+		if (node == NULL) break;
+		pthread_mutex_unlock(&offload_mutex);
+
+		req = iqueue_entry(node, struct offload_req, link);
+		errno = 0;
+		req->result = req->func(req->arg);
+		req->error = errno;
+
+		pthread_mutex_lock(&offload_mutex);
+		iqueue_enqueue(&offload_done, &req->link);
+		io_interrupt();
+	}
+	pthread_mutex_unlock(&offload_mutex);
+
+	return NULL;
+}
+
+/* Start one more helper if they are all busy, and return how many there are */
+static int offload_spawn(void)
+{
+	sigset_t all, old;
+	int nr;
+
+	// A thread preempted holding the mutex would deadlock the next one taking
+	// it on the same kernel thread, e.g. to reap completed requests
+	preempt_disable();
+	pthread_mutex_lock(&offload_mutex);
+	if (nr_offload_idle == 0 && nr_offload_threads < OFFLOAD_MAX_THREADS) {
+		// Helpers never run user threads, keep the signals for the workers
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&offload_threads[nr_offload_threads], NULL,
+				   offload_main, NULL) == 0) {
+			nr_offload_threads++;
+		}
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	nr = nr_offload_threads;
+	pthread_mutex_unlock(&offload_mutex);
+	preempt_enable();
+
+	return nr;
+}
+
+void offload_start(void)
+{
+	iqueue_init(&offload_todo);
+	iqueue_init(&offload_done);
+	offload_stopping = 0;
+	atomic_store(&nr_offload_pending, 0);
+}
+
+void offload_stop(void)
+{
+	pthread_mutex_lock(&offload_mutex);
+	offload_stopping = 1;
+	pthread_cond_broadcast(&offload_cond);
+	pthread_mutex_unlock(&offload_mutex);
+
+	for (int i = 0; i < nr_offload_threads; i++) {
+		pthread_join(offload_threads[i], NULL);
+	}
+	nr_offload_threads = 0;
+}
+
+int offload_waiting(void)
+{
+	return atomic_load(&nr_offload_pending) > 0;
+}
+
+void offload_reap(void)
+{
+	struct iqueue_node *node;
+
+	pthread_mutex_lock(&offload_mutex);
+	while ((node = iqueue_dequeue(&offload_done)) != NULL) {
+		struct offload_req *req = iqueue_entry(node, struct offload_req, link);
+
+		// @req lives on the waiter's stack, which may be gone once woken up
+		uthread_wake(req->waiter);
+		atomic_fetch_sub(&nr_offload_pending, 1);
+	}
+	pthread_mutex_unlock(&offload_mutex);
+}
+
+void *uthread_offload(uthread_offload_func_t func, void *arg)
+{
+	struct offload_req req = {.func = func, .arg = arg};
+
+	// Without any helper, the call can only block the calling kernel thread
+	if (offload_spawn() == 0) return func(arg);
+
+	uthread_sched_lock();
+	req.waiter = uthread_current();
+	atomic_fetch_add(&nr_offload_pending, 1);
+	pthread_mutex_lock(&offload_mutex);
+	iqueue_enqueue(&offload_todo, &req.link);
+	pthread_cond_signal(&offload_cond);
+	pthread_mutex_unlock(&offload_mutex);
+	// Completion is reaped with the scheduler locked, thus only once blocked
+	uthread_block();
+
+	errno = req.error;
+	return req.result;
+}
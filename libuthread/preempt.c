@@ -1,70 +1,206 @@
-#define _POSIX_SOURCE
+#define _GNU_SOURCE
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
 
 #include "private.h"
+#include "stats.h"
 #include "uthread.h"
 
-/*
- * Frequency of preemption
- * 100Hz is 100 times per second
- */
-#define HZ 100
-#define INTERVAL (1.0 / HZ * 1000) /* number of milliseconds to go off */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 struct sigaction new_act;
 struct sigaction old_act; // to store previous signal action
-struct itimerval new_timer;
-struct itimerval old_timer; // to store previous timer configuration
-sigset_t block_timer_mask;
+int preempt_poll; // whether the timer only flags the running thread
+clockid_t preempt_clock;
+unsigned int preempt_quantum; // in microseconds
+
+/*
+ * Every kernel thread running user threads has a timer of its own, which
+ * signals that very kernel thread once per quantum while armed. Timers are
+ * indexed by the number of the kernel thread they belong to, so that they can
+ * be armed and disarmed from any thread without locking.
+ */
+struct preempt_timer {
+	timer_t id;
+	atomic_bool used;
+	atomic_bool armed;
+};
+
+struct preempt_timer *timers;
+int nr_timers;
+
+/*
+ * Preemption is disabled by incrementing a counter private to each kernel
+ * thread, rather than by blocking the timer signal, so that entering and
+ * leaving a critical section costs no system call. When the timer fires within
+ * a critical section, the handler only records that a yield is pending, and
+ * the thread yields as soon as it leaves the critical section.
+ *
+ * The library's critical sections span context switches (preemption is
+ * disabled by a thread and enabled again by the next one), which is why the
+ * counter belongs to the kernel thread rather than to the user thread.
+ */
+static __thread volatile sig_atomic_t preempt_count;
+static __thread volatile sig_atomic_t yield_pending;
+
+#ifdef UTHREAD_STATS
+static atomic_ulong nr_ticks_taken, nr_ticks_deferred;
+#endif
+
+void timer_handler(int signum, siginfo_t *info, void *ucontext)
+{
+	ucontext_t *uc = ucontext;
 
-void timer_handler(int signum){
 	(void)signum;
-	uthread_yield();
+	(void)info;
+
+	if (preempt_poll || preempt_count > 0) {
+		STATS(atomic_fetch_add_explicit(&nr_ticks_deferred, 1, memory_order_relaxed));
+		yield_pending = 1;
+		// A thread which does not poll would never stop the timer on its own.
+		// Outside of critical sections, no library lock can be held here.
+		if (preempt_count == 0) uthread_tick_stop();
+		return;
+	}
+	STATS(atomic_fetch_add_explicit(&nr_ticks_taken, 1, memory_order_relaxed));
+	uthread_yield_preempted();
+
+	// The thread may have resumed on another kernel thread, whose alternate
+	// signal stack returning from the handler must not replace with the one
+	// saved in the signal frame
+	sigaltstack(NULL, &uc->uc_stack);
+}
+
+/* Arm timer @id to fire once per quantum, or disarm it if @quantum is 0 */
+static int timer_arm(timer_t id, unsigned int quantum)
+{
+	struct itimerspec spec;
+
+	spec.it_value.tv_sec = quantum / 1000000;
+	spec.it_value.tv_nsec = (quantum % 1000000) * 1000L;
+	spec.it_interval = spec.it_value;
+	return timer_settime(id, 0, &spec, NULL);
 }
 
-void preempt_start(void)
+int preempt_start(int poll, unsigned int quantum, clockid_t clock, int nr_threads)
 {
+	preempt_poll = poll;
+	preempt_quantum = quantum;
+	preempt_clock = clock;
+
+	// The table is kept across restarts, as late kernel threads may still
+	// look at it while the library stops
+	if (nr_threads > nr_timers) {
+		struct preempt_timer *table = realloc(timers, nr_threads * sizeof(*table));
+		if (table == NULL) return -1;
+		timers = table;
+		nr_timers = nr_threads;
+	}
+	for (int i = 0; i < nr_timers; i++) {
+		atomic_init(&timers[i].used, false);
+		atomic_init(&timers[i].armed, false);
+	}
+	STATS(atomic_store(&nr_ticks_taken, 0); atomic_store(&nr_ticks_deferred, 0));
+
 	// Set up sigaction
-	new_act.sa_handler = timer_handler; // set the handler
+	new_act.sa_sigaction = timer_handler; // set the handler
 	sigemptyset(&new_act.sa_mask); // no signal is blocked
-	new_act.sa_flags = 0; // no flag
+	// The handler may switch to another thread for a long time, during which
+	// the signal must not stay blocked
+	new_act.sa_flags = SA_NODEFER | SA_SIGINFO;
 	sigaction(SIGVTALRM, &new_act, &old_act);
-	
-	// Initialize mask to block SIGVTALRM
-	sigemptyset(&block_timer_mask);
-	sigaddset(&block_timer_mask, SIGVTALRM);
-
-	// Configure timer
-	// First timer interrupt after 10 msec
-	new_timer.it_value.tv_sec = 0;
-	new_timer.it_value.tv_usec = INTERVAL * 1000;
-
-	// Successive timer interrupts every 10 msec after that
-	new_timer.it_interval = new_timer.it_value;
-	setitimer(ITIMER_VIRTUAL, &new_timer, &old_timer);
+
+	return 0;
 }
 
 void preempt_stop(void)
 {
+	// Delete the timers of every kernel thread before restoring the previous
+	// signal action
+	for (int i = 0; i < nr_timers; i++) {
+		if (atomic_exchange(&timers[i].used, false)) timer_delete(timers[i].id);
+	}
+
 	// Restore previous signal action
 	sigaction(SIGVTALRM, &old_act, NULL);
-	// Restore previous timer configuration
-	setitimer(ITIMER_VIRTUAL, &old_timer, NULL);
+}
+
+int preempt_thread_start(int timer)
+{
+	struct sigevent sev = {0};
+
+	// Signal the calling kernel thread only
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGVTALRM;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(preempt_clock, &sev, &timers[timer].id) == -1) return -1;
+
+	atomic_store(&timers[timer].used, true);
+	return 0;
+}
+
+int preempt_timer_set(int timer, int armed)
+{
+	if (!atomic_load(&timers[timer].used)) return -1;
+
+	atomic_store(&timers[timer].armed, armed);
+	return timer_arm(timers[timer].id, armed ? preempt_quantum : 0);
+}
+
+int preempt_set_quantum(unsigned int quantum)
+{
+	int ret = 0;
+
+	preempt_quantum = quantum;
+	for (int i = 0; i < nr_timers; i++) {
+		if (atomic_load(&timers[i].used) && atomic_load(&timers[i].armed)
+		    && timer_arm(timers[i].id, quantum) == -1) {
+			ret = -1;
+		}
+	}
+
+	return ret;
 }
 
 void preempt_enable(void)
 {
-	sigprocmask(SIG_UNBLOCK, &block_timer_mask, NULL);
+	// Keep the critical section's memory accesses before the decrement
+	atomic_signal_fence(memory_order_seq_cst);
+	if (--preempt_count == 0 && yield_pending) {
+		yield_pending = 0;
+		uthread_yield_preempted();
+	}
 }
 
 void preempt_disable(void)
 {
-	sigprocmask(SIG_BLOCK, &block_timer_mask, NULL);
+	preempt_count++;
+	atomic_signal_fence(memory_order_seq_cst);
+}
+
+int preempt_take_pending(void)
+{
+	if (!yield_pending) return 0;
+
+	yield_pending = 0;
+	return 1;
 }
 
+#ifdef UTHREAD_STATS
+void preempt_get_stats(unsigned long *taken, unsigned long *deferred)
+{
+	*taken = atomic_load_explicit(&nr_ticks_taken, memory_order_relaxed);
+	*deferred = atomic_load_explicit(&nr_ticks_deferred, memory_order_relaxed);
+}
+#endif
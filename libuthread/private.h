@@ -10,7 +10,10 @@
 /**
  * Private context API
  */
+#include <stddef.h>
+#ifdef UTHREAD_CTX_UCONTEXT
 #include <ucontext.h>
+#endif
 
 #include "uthread.h"
 
@@ -23,8 +26,20 @@
  * Such a context is initialized for the first time when creating a thread with
  * uthread_ctx_init(). Once initialized, it can be switched to with
  * uthread_ctx_switch().
+ *
+ * The backend is selected at build time (see context.mk): the portable one
+ * relies on ucontext, while the x86-64 one only keeps the saved stack pointer,
+ * the callee-saved registers being pushed on the thread's own stack.
  */
+#ifdef UTHREAD_CTX_UCONTEXT
+#define UTHREAD_CTX_BACKEND "ucontext"
 typedef ucontext_t uthread_ctx_t;
+#else
+#define UTHREAD_CTX_BACKEND "asm"
+typedef struct uthread_ctx {
+	void *sp;
+} uthread_ctx_t;
+#endif
 
 /*
  * uthread_ctx_switch - Switch between two execution contexts
@@ -34,61 +49,432 @@ typedef ucontext_t uthread_ctx_t;
  */
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
 
+/* Default size of the stack for a thread (in bytes) */
+#define UTHREAD_STACK_SIZE 32768
+
+/* Default size the stack of a thread may grow to (in bytes) */
+#define UTHREAD_STACK_MAX (1024 * 1024)
+
+/* Smallest stack a thread can be given (in bytes) */
+#define UTHREAD_STACK_MIN 8192
+
+/* Default size of the inaccessible region below a stack (in bytes) */
+#define UTHREAD_GUARD_SIZE 4096
+
+/*
+ * uthread_stack_t - Stack segment
+ * @base: Lowest usable address of the stack segment
+ * @size: Usable size of the stack segment
+ * @max: Size the stack segment may grow to, equal to @size if it cannot grow
+ * @guard: Size of the inaccessible region below the lowest address the stack
+ *	segment may grow to
+ * @painted: Whether the segment was painted when allocated, see
+ *	uthread_set_stack_paint()
+ */
+typedef struct uthread_stack {
+	void *base;
+	size_t size;
+	size_t max;
+	size_t guard;
+	int painted;
+} uthread_stack_t;
+
 /*
  * uthread_ctx_alloc_stack - Allocate stack segment
+ * @stack: Stack segment to initialize
+ * @size: Requested usable size, rounded up to whole pages
+ * @max: Size the stack segment may grow to, rounded up to whole pages (0, or
+ *	@size at most, for a stack segment which cannot grow)
+ * @guard: Requested guard size, rounded up to whole pages (0 for none)
+ *
+ * The memory of the stack segment is only reserved, and gets committed as it is
+ * touched. Stack segments of the default geometry come from a pool which is
+ * not reentrant: the scheduler must be locked when calling this function.
  *
- * Return: Pointer to the top of a valid stack segment, or NULL in case of
+ * Return: 0 if @stack was set to a valid stack segment, or -1 in case of
  * failure
  */
-void *uthread_ctx_alloc_stack(void);
+int uthread_ctx_alloc_stack(uthread_stack_t *stack, size_t size, size_t max, size_t guard);
+
+/*
+ * uthread_ctx_alloc_stacks - Allocate several stack segments at once
+ * @stacks: Array of @n stack segments to initialize
+ * @n: Number of stack segments
+ * @size: Size of each stack segment
+ * @max: Size each stack segment may grow to
+ * @guard: Size of the inaccessible region below each stack segment
+ *
+ * Behave like @n calls to uthread_ctx_alloc_stack(), but map all the segments
+ * which cannot be taken from the pool as a single region. Each segment can
+ * still be deallocated on its own with uthread_ctx_destroy_stack().
+ *
+ * Return: 0 if all the @stacks were set to valid stack segments, or -1 in case
+ * of failure, in which case none was allocated
+ */
+int uthread_ctx_alloc_stacks(uthread_stack_t *stacks, int n, size_t size, size_t max,
+			     size_t guard);
 
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
- * @top_of_stack: Address of stack to deallocate
+ * @stack: Stack segment to deallocate, as set by uthread_ctx_alloc_stack()
+ *
+ * The stack segment is either unmapped or given back to the pool for later
+ * reuse. The scheduler must be locked when calling this function.
+ */
+void uthread_ctx_destroy_stack(uthread_stack_t *stack);
+
+/*
+ * uthread_ctx_stack_grow - Grow a stack segment down to a faulting address
+ * @stack: Stack segment of the thread which faulted
+ * @addr: Address of the fault
+ * @below: Number of bytes below @addr which must be accessible as well
+ *
+ * Meant to be called from a SIGSEGV handler, on the kernel thread running the
+ * thread which owns @stack.
+ *
+ * Return: 0 if @stack was grown to include @addr and the @below bytes under it
+ * (or down to the lowest address it may grow to), or -1 if @addr is not within
+ * @stack or there was nothing to grow
  */
-void uthread_ctx_destroy_stack(void *top_of_stack);
+int uthread_ctx_stack_grow(uthread_stack_t *stack, void *addr, size_t below);
+
+/*
+ * uthread_ctx_stack_usage - Measure the stack usage of a thread
+ * @stack: Stack segment of the thread
+ *
+ * Return: Number of bytes at the top of @stack which the thread touched so
+ * far, or -1 if @stack was not painted
+ */
+long uthread_ctx_stack_usage(const uthread_stack_t *stack);
+
+/*
+ * uthread_ctx_stack_record - Account for the stack usage of an exiting thread
+ * @stack: Stack segment of the thread
+ *
+ * Add the usage of @stack, if painted, to the histogram returned by
+ * uthread_stack_histogram(). The scheduler must be locked when calling this
+ * function.
+ */
+void uthread_ctx_stack_record(const uthread_stack_t *stack);
 
 /*
  * uthread_ctx_init - Initialize a thread's execution context
  * @uctx: Pointer to thread context to initialize
- * @top_of_stack: Pointer to the top of a valid stack segment, as allocated by
- *	uthread_ctx_alloc_stack()
+ * @stack: Stack segment, as allocated by uthread_ctx_alloc_stack()
  * @func: Function to be executed by the thread
  *
  * Return: 0 if @uctx was properly initialized, or -1 in case of failure
  */
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, const uthread_stack_t *stack,
 					 uthread_func_t func);
 
 
+/**
+ * Private scheduler API
+ */
+
+/*
+ * uthread_sched_lock - Lock the scheduler
+ *
+ * Disable preemption and, in M:N mode, exclude the other workers from the
+ * scheduler's shared state (thread table, stack pool, BLOCKED and ZOMBIE
+ * queues).
+ */
+void uthread_sched_lock(void);
+
+/*
+ * uthread_sched_unlock - Unlock the scheduler
+ */
+void uthread_sched_unlock(void);
+
+/*
+ * uthread_yield_preempted - Yield on behalf of the preemption timer
+ *
+ * Behave like uthread_yield(), but account for the current thread having used
+ * up its time slice (see the MLFQ mode of uthread_opts_t).
+ */
+void uthread_yield_preempted(void);
+
+/*
+ * uthread_tick_stop - Stop the preemption timer if there is no one to preempt for
+ *
+ * Disarm the timer of the calling worker if no other thread is ready to run on
+ * it. Called by the timer handler when it defers a tick, with preemption
+ * enabled.
+ */
+void uthread_tick_stop(void);
+
+struct tcb;
+
+/*
+ * uthread_nr_workers - Get the number of workers
+ *
+ * Return: Number of kernel threads running user threads, 1 unless in M:N mode
+ */
+int uthread_nr_workers(void);
+
+/*
+ * uthread_current - Get the currently running thread
+ *
+ * Return: Control block of the calling thread
+ */
+struct tcb *uthread_current(void);
+
+/*
+ * uthread_block - Block the currently running thread
+ *
+ * Must be called with the scheduler locked, once the calling thread is
+ * registered where it will be woken up from with uthread_wake(). Returns once
+ * the thread was woken up and runs again, with the scheduler unlocked.
+ */
+void uthread_block(void);
+
+/*
+ * uthread_wake - Make a blocked thread ready to run again
+ * @thr: Thread blocked in uthread_block()
+ *
+ * Must be called with the scheduler locked.
+ */
+void uthread_wake(struct tcb *thr);
+
+/*
+ * uthread_wake_switch - Make a blocked thread run right away
+ * @thr: Thread blocked in uthread_block()
+ *
+ * Switch directly from the current thread to @thr, without @thr going through
+ * a ready queue, the current thread being put back into its ready queue. Falls
+ * back to uthread_wake() if @thr has a lower priority than the current thread
+ * or is pinned to another worker. Must be called with the scheduler locked, and
+ * returns once the current thread runs again, with the scheduler unlocked.
+ */
+void uthread_wake_switch(struct tcb *thr);
+
+
 /**
  * Private preemption API
  */
 
 /*
  * preempt_start - Start thread preemption
+ * @poll: Whether the timer handler only flags the running thread, which then
+ *	yields at its next preemption point instead of being switched out from
+ *	the handler
+ * @quantum: Time slice in microseconds
+ * @clock: Clock measuring the time slices, e.g. CLOCK_MONOTONIC or
+ *	CLOCK_THREAD_CPUTIME_ID
+ * @nr_threads: Number of kernel threads which will run user threads
+ *
+ * Setup a timer handler that forcefully yields the currently running thread.
+ * Each kernel thread then creates its own timer with preempt_thread_start().
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
- * setup a timer handler that forcefully yields the currently running thread.
+ * Return: 0 in case of success, -1 in case of memory allocation failure
  */
-void preempt_start(void);
+int preempt_start(int poll, unsigned int quantum, clockid_t clock, int nr_threads);
 
 /*
  * preempt_stop - Stop thread preemption
  *
- * Restore previous timer configuration, and previous action associated to
- * virtual alarm signals.
+ * Delete the timers of all the kernel threads and restore the previous action
+ * associated to virtual alarm signals.
  */
 void preempt_stop(void);
 
+/*
+ * preempt_thread_start - Create the preemption timer of the calling kernel thread
+ * @timer: Number of the calling kernel thread, below the @nr_threads passed
+ *	to preempt_start()
+ *
+ * Every kernel thread running user threads needs its own timer, which sends a
+ * virtual alarm to that kernel thread once per quantum of @clock (see
+ * preempt_start()) while armed. The timer is created disarmed.
+ *
+ * Return: 0 in case of success, -1 if the timer could not be created
+ */
+int preempt_thread_start(int timer);
+
+/*
+ * preempt_timer_set - Arm or disarm a preemption timer
+ * @timer: Number of the kernel thread owning the timer
+ * @armed: Whether the timer must fire once per quantum or not at all
+ *
+ * This can be called from any kernel thread, and from the timer handler.
+ *
+ * Return: 0 in case of success, -1 if preemption is not started or if the timer
+ * does not exist (yet)
+ */
+int preempt_timer_set(int timer, int armed);
+
+/*
+ * preempt_set_quantum - Change the time slice of all the kernel threads
+ * @quantum: New time slice in microseconds
+ *
+ * Return: 0 in case of success, -1 if a timer could not be rearmed
+ */
+int preempt_set_quantum(unsigned int quantum);
+
 /*
  * preempt_enable - Enable preemption
+ *
+ * Leave a critical section opened by preempt_disable(). When leaving the
+ * outermost critical section while the timer fired in the meantime, the
+ * calling thread yields.
  */
 void preempt_enable(void);
 
 /*
  * preempt_disable - Disable preemption
+ *
+ * Open a critical section, which can be nested. This costs no system call: the
+ * timer keeps firing but its handler defers the yield until preempt_enable().
  */
 void preempt_disable(void);
 
+/*
+ * preempt_take_pending - Consume a pending yield
+ *
+ * Return: 1 if the timer fired since the calling kernel thread last yielded on
+ * its behalf, in which case the pending yield is cleared, or 0 otherwise
+ */
+int preempt_take_pending(void);
+
+#ifdef UTHREAD_STATS
+/*
+ * preempt_get_stats - Get the preemption tick counters
+ * @taken: Ticks which made the running thread yield right away
+ * @deferred: Ticks which left a pending yield, as preemption was disabled or
+ *	the UTHREAD_PREEMPT_POLL mode on
+ *
+ * The counters are reset by preempt_start().
+ */
+void preempt_get_stats(unsigned long *taken, unsigned long *deferred);
+#endif
+
+
+/**
+ * Private I/O API
+ */
+
+/*
+ * io_start - Start the I/O poller
+ *
+ * Return: 0 in case of success, -1 if the epoll instance could not be created
+ */
+int io_start(void);
+
+/*
+ * io_stop - Stop the I/O poller
+ *
+ * Release the epoll instance and forget about the registered descriptors.
+ */
+void io_stop(void);
+
+/*
+ * io_waiting - Check whether threads wait for I/O
+ *
+ * Return: 1 if some thread is blocked in an I/O wrapper, or 0 otherwise
+ */
+int io_waiting(void);
+
+/*
+ * io_poll - Wake up the threads whose descriptors are ready
+ * @timeout: Maximum time to block in milliseconds, 0 to return immediately or
+ *	-1 to block until a descriptor gets ready or io_interrupt() is called
+ *
+ * The woken up threads are made ready on the calling worker. Must be called
+ * with the scheduler unlocked. errno is preserved.
+ *
+ * Return: Number of threads woken up
+ */
+int io_poll(int timeout);
+
+/*
+ * io_interrupt - Interrupt a blocked io_poll()
+ *
+ * This can be called from any kernel thread. If no kernel thread is blocked in
+ * io_poll(), the next call to io_poll() returns early instead.
+ */
+void io_interrupt(void);
+
+
+/**
+ * Private sleep API
+ */
+
+/*
+ * sleep_start - Prepare for threads to sleep
+ *
+ * Must be called before io_start().
+ *
+ * Return: 0 in case of success, -1 if the timing wheel or its timerfd could
+ * not be created
+ */
+int sleep_start(void);
+
+/*
+ * sleep_stop - Release the timing wheel
+ *
+ * No thread must be sleeping anymore.
+ */
+void sleep_stop(void);
+
+/*
+ * sleep_fd - Get the timerfd of the sleeping threads
+ *
+ * The timerfd gets readable once the nearest deadline is reached. io_start()
+ * registers it with the I/O poller, which then calls sleep_expire().
+ *
+ * Return: File descriptor of the timerfd
+ */
+int sleep_fd(void);
+
+/*
+ * sleep_waiting - Check whether threads are sleeping
+ *
+ * Return: 1 if some thread is blocked in uthread_sleep_until(), or 0 otherwise
+ */
+int sleep_waiting(void);
+
+/*
+ * sleep_expire - Wake up the threads whose deadline is reached
+ *
+ * Must be called with the scheduler locked.
+ */
+void sleep_expire(void);
+
+
+/**
+ * Private offload API
+ */
+
+/*
+ * offload_start - Prepare the offload pool
+ *
+ * Helper kernel threads are only started once calls get offloaded.
+ */
+void offload_start(void);
+
+/*
+ * offload_stop - Stop the helper kernel threads
+ *
+ * No call must be offloaded anymore.
+ */
+void offload_stop(void);
+
+/*
+ * offload_waiting - Check whether threads wait for offloaded calls
+ *
+ * Return: 1 if some thread is blocked in uthread_offload(), or 0 otherwise
+ */
+int offload_waiting(void);
+
+/*
+ * offload_reap - Wake up the threads whose offloaded call completed
+ *
+ * Helpers call io_interrupt() after completing a call, so this is called by
+ * io_poll(), with the scheduler locked. Preemption is thus disabled while the
+ * offload pool's mutex is held, as the holder being preempted would deadlock
+ * the next thread taking it on the same kernel thread.
+ */
+void offload_reap(void);
+
 #endif /* _UTHREAD_PRIVATE_H */
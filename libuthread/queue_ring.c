@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "queue.h"
+
+/*
+ * Array-backed implementation of the queue API
+ *
+ * Items are stored in a circular array whose capacity is always a power of
+ * two, so that wrapping an index around is a simple mask. The array doubles
+ * when full, which keeps enqueue amortized O(1) without allocating anything
+ * per item, and items sit next to each other in memory, which suits hardware
+ * prefetching when iterating.
+ */
+
+#define QUEUE_INIT_CAPACITY 16
+
+struct queue {
+	int length;
+	unsigned int head; // index of the oldest item
+	unsigned int mask; // capacity - 1
+	void **items;
+	int iter; // position of the item being iterated over, -1 if none
+};
+
+/* Slot of the item at position @pos, 0 being the oldest item */
+static inline void **queue_slot(queue_t queue, unsigned int pos)
+{
+	return &queue->items[(queue->head + pos) & queue->mask];
+}
+
+queue_t queue_create(void)
+{
+	queue_t new_queue = (queue_t)malloc(sizeof(struct queue));
+	if (!new_queue) return NULL;
+
+	new_queue->items = malloc(QUEUE_INIT_CAPACITY * sizeof(void*));
+	if (!new_queue->items) {
+		free(new_queue);
+		return NULL;
+	}
+	new_queue->length = 0;
+	new_queue->head = 0;
+	new_queue->mask = QUEUE_INIT_CAPACITY - 1;
+	new_queue->iter = -1;
+
+	return new_queue;
+}
+
+int queue_destroy(queue_t queue)
+{
+	if (queue == NULL || queue->length != 0) return -1;
+
+	free(queue->items);
+	free(queue);
+	queue = NULL;
+	return 0;
+}
+
+/* Double the capacity of @queue, unwrapping its items at the same time */
+static int queue_grow(queue_t queue)
+{
+	unsigned int capacity = queue->mask + 1;
+	unsigned int first = capacity - queue->head; // items before wrapping
+	void **items = malloc(2 * capacity * sizeof(void*));
+
+	if (!items) return -1;
+
+	memcpy(items, queue->items + queue->head, first * sizeof(void*));
+	memcpy(items + first, queue->items, queue->head * sizeof(void*));
+	free(queue->items);
+	queue->items = items;
+	queue->head = 0;
+	queue->mask = 2 * capacity - 1;
+	return 0;
+}
+
+int queue_enqueue(queue_t queue, void *data)
+{
+	if (queue == NULL || data == NULL) return -1;
+
+	if ((unsigned int)queue->length == queue->mask + 1 && queue_grow(queue))
+		return -1;
+
+	*queue_slot(queue, queue->length) = data;
+	queue->length++;
+	return 0;
+}
+
+int queue_dequeue(queue_t queue, void **data)
+{
+	if (queue == NULL || data == NULL || queue->length == 0) return -1;
+
+	*data = queue->items[queue->head];
+	queue->head = (queue->head + 1) & queue->mask;
+	queue->length--;
+
+	// Keep the iteration cursor on the same item
+	if (queue->iter >= 0) queue->iter--;
+	return 0;
+}
+
+int queue_delete(queue_t queue, void *data)
+{
+	if (queue == NULL || data == NULL || queue->length == 0) return -1;
+
+	int pos;
+
+	// check if @data is in the queue
+	for (pos = 0; pos < queue->length; pos++) {
+		if (*queue_slot(queue, pos) == data) break;
+	}
+	if (pos == queue->length) return -1;
+
+	// close the gap by shifting whichever side of it is shorter
+	if (pos < queue->length / 2) {
+		for (int i = pos; i > 0; i--) {
+			*queue_slot(queue, i) = *queue_slot(queue, i - 1);
+		}
+		queue->head = (queue->head + 1) & queue->mask;
+	} else {
+		for (int i = pos; i < queue->length - 1; i++) {
+			*queue_slot(queue, i) = *queue_slot(queue, i + 1);
+		}
+	}
+	queue->length--;
+
+	// Either way, the items newer than @data move one position closer to the
+	// head: keep the iteration cursor on the same item (or on the one which
+	// took the place of the deleted current item)
+	if (queue->iter >= pos) queue->iter--;
+	return 0;
+}
+
+int queue_iterate(queue_t queue, queue_func_t func, void *arg, void **data)
+{
+	if (queue == NULL || func == NULL) return -1;
+
+	int saved_iter = queue->iter; // cursor of an enclosing iteration, if any
+
+	for (queue->iter = 0; queue->iter < queue->length; queue->iter++) {
+		void *item = *queue_slot(queue, queue->iter);
+
+		if (func(queue, item, arg) == 1) {
+			if (data != NULL) *data = item;
+			break;
+		}
+	}
+
+	queue->iter = saved_iter;
+	return 0;
+}
+
+int queue_length(queue_t queue)
+{
+	if (queue == NULL) return -1;
+
+	return queue->length;
+}
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iqueue.h"
+#include "private.h"
+#include "uthread.h"
+#include "wheel.h"
+
+/*
+ * Sleeping threads
+ *
+ * Sleeping threads are blocked with a timer in a timing wheel, whose ticks are
+ * SLEEP_TICK_NS long: deadlines are rounded up to the next tick. A timerfd is
+ * armed for the next wheel event and registered with the I/O poller, so that an
+ * idle worker blocks until the nearest deadline rather than spinning.
+ *
+ * The wheel is protected by the scheduler lock.
+ */
+
+#define SLEEP_TICK_SHIFT 16
+#define SLEEP_TICK_NS (1 << SLEEP_TICK_SHIFT) // about 65 us
+
+struct sleeper {
+	struct wheel_timer timer;
+	struct tcb *thr;
+};
+
+static wheel_t sleep_wheel;
+static int timer_fd = -1;
+static uint64_t armed_tick = WHEEL_NEVER; // tick @timer_fd fires at
+static atomic_int nr_sleepers;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Make sure @timer_fd fires by the next wheel event */
+static void sleep_arm(void)
+{
+	uint64_t next = wheel_next(sleep_wheel);
+	struct itimerspec spec = {0};
+
+	if (next == WHEEL_NEVER || next >= armed_tick) return;
+
+	spec.it_value.tv_sec = (next << SLEEP_TICK_SHIFT) / 1000000000;
+	spec.it_value.tv_nsec = (next << SLEEP_TICK_SHIFT) % 1000000000;
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+		armed_tick = next;
+	}
+}
+
+int sleep_start(void)
+{
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd == -1) return -1;
+	sleep_wheel = wheel_create(now_ns() >> SLEEP_TICK_SHIFT);
+	if (sleep_wheel == NULL) {
+		sleep_stop();
+		return -1;
+	}
+	armed_tick = WHEEL_NEVER;
+	atomic_store(&nr_sleepers, 0);
+
+	return 0;
+}
+
+void sleep_stop(void)
+{
+	if (timer_fd != -1) close(timer_fd);
+	timer_fd = -1;
+	wheel_destroy(sleep_wheel);
+	sleep_wheel = NULL;
+}
+
+int sleep_fd(void)
+{
+	return timer_fd;
+}
+
+int sleep_waiting(void)
+{
+	return atomic_load(&nr_sleepers) > 0;
+}
+
+void sleep_expire(void)
+{
+	uint64_t now = now_ns() >> SLEEP_TICK_SHIFT, count;
+	struct iqueue expired;
+	struct iqueue_node *node;
+
+	if (read(timer_fd, &count, sizeof(count)) == -1) {
+		// Not fired yet, or drained already
+	}
+	if (armed_tick <= now) armed_tick = WHEEL_NEVER;
+
+	iqueue_init(&expired);
+	wheel_advance(sleep_wheel, now, &expired);
+	while ((node = iqueue_dequeue(&expired)) != NULL) {
+		struct sleeper *s = iqueue_entry(node, struct sleeper, timer.link);
+
+		// @s lives on the sleeper's stack, which may be gone once woken up
+		atomic_fetch_sub(&nr_sleepers, 1);
+		uthread_wake(s->thr);
+	}
+	sleep_arm();
+}
+
+int uthread_sleep_until(const struct timespec *deadline)
+{
+	struct sleeper s;
+	uint64_t ns;
+
+	if (deadline == NULL || deadline->tv_sec < 0 || deadline->tv_nsec < 0
+	    || deadline->tv_nsec >= 1000000000) {
+		errno = EINVAL;
+		return -1;
+	}
+	ns = deadline->tv_sec * 1000000000ull + deadline->tv_nsec;
+	if (ns <= now_ns()) return 0;
+
+	uthread_sched_lock();
+	s.thr = uthread_current();
+	wheel_add(sleep_wheel, &s.timer, (ns + SLEEP_TICK_NS - 1) >> SLEEP_TICK_SHIFT);
+	sleep_arm();
+	atomic_fetch_add(&nr_sleepers, 1);
+	uthread_block();
+
+	return 0;
+}
+
+int uthread_sleep_ns(uint64_t ns)
+{
+	uint64_t deadline = now_ns() + ns;
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000,
+		.tv_nsec = deadline % 1000000000,
+	};
+
+	return uthread_sleep_until(&ts);
+}
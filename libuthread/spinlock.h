@@ -0,0 +1,54 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * provides a minimal test-and-test-and-set spinlock, used to protect the
+ * scheduler state shared by the kernel threads of the M:N mode.
+ *
+ * A spinlock must only be held with preemption disabled, otherwise the holder
+ * could be switched out by the timer and leave other workers spinning.
+ */
+
+#include <sched.h>
+#include <stdatomic.h>
+
+/* Failed attempts after which a waiter yields its CPU to the kernel */
+#define SPIN_YIELD_AFTER 128
+
+typedef struct spinlock {
+	atomic_int locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline void spin_init(spinlock_t *lock)
+{
+	atomic_init(&lock->locked, 0);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (atomic_exchange_explicit(&lock->locked, 1, memory_order_acquire)) {
+		for (int spins = 0; atomic_load_explicit(&lock->locked, memory_order_relaxed); spins++) {
+			// The holder may have been descheduled by the kernel, e.g. with
+			// more workers than CPUs: let it run rather than burn the slice
+			if (spins < SPIN_YIELD_AFTER) spin_relax();
+			else sched_yield();
+		}
+	}
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	atomic_store_explicit(&lock->locked, 0, memory_order_release);
+}
+
+#endif /* _SPINLOCK_H */
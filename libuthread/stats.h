@@ -0,0 +1,50 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * provides the clock which the scheduler statistics and the event trace are
+ * timed with, along with STATS(), which wraps the statements maintaining the
+ * statistics. These only exist when the library is built with UTHREAD_STATS
+ * defined (`make STATS=1`), and disappear from the hot paths otherwise.
+ *
+ * Durations are measured in clock ticks of stats_clock(): the time-stamp
+ * counter on x86-64, which is read in a few cycles on bare metal (but may trap
+ * into the hypervisor in a virtual machine), and nanoseconds elsewhere. They
+ * only get converted into nanoseconds when read by the user.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#ifdef UTHREAD_STATS
+#define STATS(stmt) do { stmt; } while (0)
+#else
+#define STATS(stmt) do { } while (0)
+#endif
+
+static inline uint64_t stats_clock(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/*
+ * stats_ns - Convert a duration into nanoseconds
+ * @ticks: Duration in ticks of stats_clock()
+ *
+ * The first call calibrates the clock against CLOCK_MONOTONIC_RAW, which takes
+ * about a millisecond.
+ */
+uint64_t stats_ns(uint64_t ticks);
+
+#endif /* _STATS_H */
@@ -0,0 +1,333 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "iqueue.h"
+#include "private.h"
+#include "spinlock.h"
+#include "uthread.h"
+
+/*
+ * Synchronization primitives
+ *
+ * Every object has its own FIFO of waiters, which are blocked threads (in the
+ * BLOCKED state) linked through a struct waiter living on their stack. The wait
+ * queues are protected by the scheduler lock, which a blocking thread holds
+ * until it is switched out, so that a wakeup can never be missed. Uncontended
+ * operations only take an atomic instruction and never lock the scheduler.
+ *
+ * Ownership is handed over directly: unlocking a mutex with waiters makes the
+ * oldest waiter the owner before waking it up, and posting a semaphore with
+ * waiters gives the unit to the oldest waiter. A woken up thread thus never has
+ * to compete again, and a thread which releases and retakes a lock in a loop
+ * cannot starve the waiters.
+ */
+
+#define MUTEX_WAITERS ((uintptr_t)1) // low bit of the mutex state
+
+struct waiter {
+	struct tcb *thr;
+	uthread_mutex_t mutex; // mutex to own when woken up, for condition variables
+	struct iqueue_node link;
+};
+
+struct uthread_mutex {
+	_Atomic uintptr_t state; // owner, or'ed with MUTEX_WAITERS if any, 0 if free
+	unsigned int spin; // attempts before blocking, in M:N mode
+	struct iqueue waiters;
+};
+
+struct uthread_cond {
+	struct iqueue waiters;
+};
+
+struct uthread_sem {
+	atomic_long count; // available units, or minus the number of waiters
+	long wakeups; // units given to waiters not queued yet
+	struct iqueue waiters;
+};
+
+/* Queue the calling thread on @queue and block, the scheduler being locked */
+static void wait_on(struct iqueue *queue)
+{
+	struct waiter w = {.thr = uthread_current(), .mutex = NULL};
+
+	iqueue_enqueue(queue, &w.link);
+	uthread_block();
+}
+
+/* Wake the oldest waiter of @queue up, the scheduler being locked */
+static struct tcb *wake_one(struct iqueue *queue)
+{
+	struct iqueue_node *node = iqueue_dequeue(queue);
+	struct tcb *thr;
+
+	if (node == NULL) return NULL;
+	// The waiter's stack may be gone as soon as it is woken up
+	thr = iqueue_entry(node, struct waiter, link)->thr;
+	uthread_wake(thr);
+	return thr;
+}
+
+/*
+ * Mutex
+ */
+
+uthread_mutex_t uthread_mutex_create(void)
+{
+	uthread_mutex_t mutex = malloc(sizeof(struct uthread_mutex));
+
+	if (mutex == NULL) return NULL;
+	atomic_init(&mutex->state, 0);
+	mutex->spin = UTHREAD_MUTEX_SPIN;
+	iqueue_init(&mutex->waiters);
+
+	return mutex;
+}
+
+int uthread_mutex_destroy(uthread_mutex_t mutex)
+{
+	if (mutex == NULL || atomic_load(&mutex->state) != 0) return -1;
+
+	free(mutex);
+	return 0;
+}
+
+int uthread_mutex_set_spin(uthread_mutex_t mutex, unsigned int spin)
+{
+	if (mutex == NULL) return -1;
+
+	mutex->spin = spin;
+	return 0;
+}
+
+int uthread_mutex_trylock(uthread_mutex_t mutex)
+{
+	uintptr_t unlocked = 0;
+
+	if (mutex == NULL) return -1;
+
+	return atomic_compare_exchange_strong(&mutex->state, &unlocked,
+					      (uintptr_t)uthread_current()) ? 0 : -1;
+}
+
+/*
+ * Make the thread of waiter @w own @mutex, the scheduler being locked: right
+ * away if @mutex is free, or otherwise once the owner unlocks it, which then
+ * wakes the thread up
+ *
+ * Return: 1 if the thread owns @mutex already, 0 if it was queued
+ */
+static int mutex_take(uthread_mutex_t mutex, struct waiter *w)
+{
+	uintptr_t state = atomic_load(&mutex->state);
+
+	for (;;) {
+		if (state == 0) {
+			if (atomic_compare_exchange_weak(&mutex->state, &state, (uintptr_t)w->thr)) {
+				return 1;
+			}
+		} else if (state & MUTEX_WAITERS
+			   || atomic_compare_exchange_weak(&mutex->state, &state,
+							   state | MUTEX_WAITERS)) {
+			// The owner now has to unlock through mutex_release()
+			iqueue_enqueue(&mutex->waiters, &w->link);
+			return 0;
+		}
+	}
+}
+
+/* Release @mutex, whose state has MUTEX_WAITERS set, the scheduler being locked */
+static void mutex_release(uthread_mutex_t mutex)
+{
+	struct iqueue_node *node = iqueue_dequeue(&mutex->waiters);
+	uintptr_t next;
+
+	// Hand the mutex over to the oldest waiter
+	next = (uintptr_t)iqueue_entry(node, struct waiter, link)->thr;
+	if (iqueue_length(&mutex->waiters)) next |= MUTEX_WAITERS;
+	atomic_store(&mutex->state, next);
+	uthread_wake((struct tcb *)(next & ~MUTEX_WAITERS));
+}
+
+int uthread_mutex_lock(uthread_mutex_t mutex)
+{
+	struct waiter w;
+
+	if (mutex == NULL) return -1;
+	if (uthread_mutex_trylock(mutex) == 0) return 0;
+
+	w.thr = uthread_current();
+	w.mutex = mutex;
+	if ((atomic_load(&mutex->state) & ~MUTEX_WAITERS) == (uintptr_t)w.thr) {
+		return -1; // already the owner
+	}
+
+	// The owner may be about to unlock it from another worker
+	if (uthread_nr_workers() > 1) {
+		for (unsigned int i = 0; i < mutex->spin; i++) {
+			spin_relax();
+			if (atomic_load_explicit(&mutex->state, memory_order_relaxed) == 0
+			    && uthread_mutex_trylock(mutex) == 0) {
+				return 0;
+			}
+		}
+	}
+
+	uthread_sched_lock();
+	if (mutex_take(mutex, &w)) { // released in the meantime
+		uthread_sched_unlock();
+		return 0;
+	}
+	uthread_block(); // owning the mutex once woken up
+
+	return 0;
+}
+
+int uthread_mutex_unlock(uthread_mutex_t mutex)
+{
+	uintptr_t self = (uintptr_t)uthread_current(), state = self;
+
+	if (mutex == NULL) return -1;
+	if (atomic_compare_exchange_strong(&mutex->state, &state, 0)) return 0;
+	if (state != (self | MUTEX_WAITERS)) return -1; // not the owner
+
+	uthread_sched_lock();
+	mutex_release(mutex);
+	uthread_sched_unlock();
+
+	return 0;
+}
+
+/*
+ * Condition variable
+ *
+ * A signaled waiter is not woken up to compete for the mutex: it is moved to
+ * the mutex's wait queue, unless it can own the mutex right away. Broadcasting
+ * thus wakes the waiters up one at a time, as the mutex gets handed over.
+ */
+
+uthread_cond_t uthread_cond_create(void)
+{
+	uthread_cond_t cond = malloc(sizeof(struct uthread_cond));
+
+	if (cond == NULL) return NULL;
+	iqueue_init(&cond->waiters);
+
+	return cond;
+}
+
+int uthread_cond_destroy(uthread_cond_t cond)
+{
+	if (cond == NULL || iqueue_length(&cond->waiters)) return -1;
+
+	free(cond);
+	return 0;
+}
+
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex)
+{
+	uintptr_t self = (uintptr_t)uthread_current(), state = self;
+	struct waiter w = {.thr = uthread_current(), .mutex = mutex};
+
+	if (cond == NULL || mutex == NULL) return -1;
+	if ((atomic_load(&mutex->state) & ~MUTEX_WAITERS) != self) return -1;
+
+	// Signals need the scheduler lock, none can be missed until blocked
+	uthread_sched_lock();
+	if (!atomic_compare_exchange_strong(&mutex->state, &state, 0)) {
+		mutex_release(mutex);
+	}
+	iqueue_enqueue(&cond->waiters, &w.link);
+	uthread_block(); // owning the mutex again once woken up
+
+	return 0;
+}
+
+/* Hand the oldest waiter of @cond over to its mutex, the scheduler being locked */
+static int cond_wake(uthread_cond_t cond)
+{
+	struct iqueue_node *node = iqueue_dequeue(&cond->waiters);
+	struct waiter *w;
+
+	if (node == NULL) return 0;
+	w = iqueue_entry(node, struct waiter, link);
+	if (mutex_take(w->mutex, w)) uthread_wake(w->thr);
+	return 1;
+}
+
+int uthread_cond_signal(uthread_cond_t cond)
+{
+	if (cond == NULL) return -1;
+
+	uthread_sched_lock();
+	cond_wake(cond);
+	uthread_sched_unlock();
+
+	return 0;
+}
+
+int uthread_cond_broadcast(uthread_cond_t cond)
+{
+	if (cond == NULL) return -1;
+
+	uthread_sched_lock();
+	while (cond_wake(cond))
+		;
+	uthread_sched_unlock();
+
+	return 0;
+}
+
+/*
+ * Semaphore
+ */
+
+uthread_sem_t uthread_sem_create(unsigned int count)
+{
+	uthread_sem_t sem = malloc(sizeof(struct uthread_sem));
+
+	if (sem == NULL) return NULL;
+	atomic_init(&sem->count, count);
+	sem->wakeups = 0;
+	iqueue_init(&sem->waiters);
+
+	return sem;
+}
+
+int uthread_sem_destroy(uthread_sem_t sem)
+{
+	if (sem == NULL || atomic_load(&sem->count) < 0) return -1;
+
+	free(sem);
+	return 0;
+}
+
+int uthread_sem_down(uthread_sem_t sem)
+{
+	if (sem == NULL) return -1;
+	if (atomic_fetch_sub(&sem->count, 1) > 0) return 0;
+
+	uthread_sched_lock();
+	if (sem->wakeups > 0) { // posted before we could queue up
+		sem->wakeups--;
+		uthread_sched_unlock();
+		return 0;
+	}
+	wait_on(&sem->waiters); // given a unit once woken up
+
+	return 0;
+}
+
+int uthread_sem_up(uthread_sem_t sem)
+{
+	if (sem == NULL) return -1;
+	if (atomic_fetch_add(&sem->count, 1) >= 0) return 0;
+
+	// A thread waits, or is about to
+	uthread_sched_lock();
+	if (wake_one(&sem->waiters) == NULL) sem->wakeups++;
+	uthread_sched_unlock();
+
+	return 0;
+}
@@ -0,0 +1,276 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "private.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "trace.h"
+#include "uthread.h"
+
+/*
+ * Scheduling event trace
+ *
+ * Every worker records into a ring buffer of its own, so that recording is a
+ * plain store followed by the increment of the ring's position, which no other
+ * kernel thread ever writes to. Timestamps are ticks of stats_clock(), only
+ * converted when the trace is dumped. Since the workers' rings are separate,
+ * a dump puts each worker on a track of its own, on which its switches form
+ * the slices during which a thread ran.
+ *
+ * A worker may have checked that tracing is on right before the trace stops,
+ * and still be writing its record. A ring is thus flagged while a record is
+ * written to it, and the flag only set before checking that tracing is still on:
+ * once tracing is off and no ring is flagged, no worker touches the records
+ * anymore, so that they can be reset or dumped. Workers may still flag rings,
+ * so rings replaced by a trace of another size are only freed when the library
+ * stops.
+ */
+
+struct trace_record {
+	uint64_t time;
+	uthread_t tid; // thread switched out for switches
+	uthread_t next; // thread switched in for switches
+	int arg; // reason of a switch, or return value of an exit
+	int type;
+};
+
+struct trace_ring {
+	struct trace_record *records;
+	uint64_t head; // number of records written so far
+	size_t mask; // number of records minus 1, a power of 2 minus 1
+	atomic_int writing; // whether the worker is writing a record
+};
+
+/* Rings of a previous trace, which late workers may still flag */
+struct trace_retired {
+	struct trace_ring *rings;
+	int nr_rings;
+	struct trace_retired *next;
+};
+
+atomic_int trace_on;
+static struct trace_ring *_Atomic rings;
+static int nr_rings;
+static size_t ring_size; // number of records per ring
+static struct trace_retired *retired_rings;
+
+/* Flag the ring of worker @worker, or return NULL if tracing is off */
+static struct trace_ring *trace_begin(int worker)
+{
+	struct trace_ring *all = atomic_load_explicit(&rings, memory_order_acquire);
+	struct trace_ring *ring;
+
+	if (all == NULL) return NULL;
+	ring = &all[worker];
+	atomic_store(&ring->writing, 1);
+	if (!atomic_load(&trace_on)) {
+		atomic_store_explicit(&ring->writing, 0, memory_order_release);
+		return NULL;
+	}
+	return ring;
+}
+
+static void trace_end(struct trace_ring *ring)
+{
+	atomic_store_explicit(&ring->writing, 0, memory_order_release);
+}
+
+static struct trace_record *trace_next(struct trace_ring *ring)
+{
+	return &ring->records[ring->head++ & ring->mask];
+}
+
+void trace_event(int worker, enum trace_type type, uthread_t tid, int arg)
+{
+	struct trace_ring *ring = trace_begin(worker);
+	struct trace_record *rec;
+
+	if (ring == NULL) return;
+	rec = trace_next(ring);
+	rec->time = stats_clock();
+	rec->tid = tid;
+	rec->arg = arg;
+	rec->type = type;
+	trace_end(ring);
+}
+
+void trace_switch(int worker, uthread_t prev, uthread_t next, enum trace_reason reason)
+{
+	struct trace_ring *ring = trace_begin(worker);
+	struct trace_record *rec;
+
+	if (ring == NULL) return;
+	rec = trace_next(ring);
+	rec->time = stats_clock();
+	rec->tid = prev;
+	rec->next = next;
+	rec->arg = reason;
+	rec->type = TRACE_SWITCH;
+	trace_end(ring);
+}
+
+/* Wait for the workers to be done with the records, tracing being off */
+static void trace_quiesce(void)
+{
+	struct trace_ring *all = atomic_load(&rings);
+
+	for (int i = 0; i < nr_rings; i++) {
+		for (int spins = 0; atomic_load(&all[i].writing); spins++) {
+			if (spins < SPIN_YIELD_AFTER) spin_relax();
+			else sched_yield();
+		}
+	}
+}
+
+static void trace_free_rings(struct trace_ring *all, int n)
+{
+	for (int i = 0; i < n; i++)
+		free(all[i].records);
+	free(all);
+}
+
+void trace_free(void)
+{
+	atomic_store(&trace_on, 0);
+	trace_free_rings(atomic_load(&rings), nr_rings);
+	atomic_store(&rings, NULL);
+	nr_rings = 0;
+	while (retired_rings) {
+		struct trace_retired *old = retired_rings;
+
+		retired_rings = old->next;
+		trace_free_rings(old->rings, old->nr_rings);
+		free(old);
+	}
+}
+
+int uthread_trace_start(size_t nr_events)
+{
+	struct trace_ring *all = atomic_load(&rings), *new;
+	struct trace_retired *old = NULL;
+	int n = uthread_nr_workers();
+	size_t size = 1;
+
+	if (n == 0 || nr_events == 0 || atomic_load(&trace_on)) return -1;
+	while (size < nr_events)
+		size *= 2;
+
+	// Records of the last trace may still be in progress
+	trace_quiesce();
+	if (all && nr_rings == n && ring_size == size) {
+		for (int i = 0; i < n; i++)
+			all[i].head = 0;
+		atomic_store(&trace_on, 1);
+		return 0;
+	}
+
+	new = calloc(n, sizeof(*new));
+	if (all) old = malloc(sizeof(*old));
+	if (new == NULL || (all && old == NULL)) {
+		free(new);
+		return -1;
+	}
+	for (int i = 0; i < n; i++) {
+		new[i].records = malloc(size * sizeof(struct trace_record));
+		new[i].mask = size - 1;
+		if (new[i].records == NULL) {
+			trace_free_rings(new, i);
+			free(old);
+			return -1;
+		}
+	}
+	if (all) {
+		*old = (struct trace_retired){all, nr_rings, retired_rings};
+		retired_rings = old;
+	}
+	atomic_store(&rings, new);
+	nr_rings = n;
+	ring_size = size;
+	atomic_store(&trace_on, 1);
+
+	return 0;
+}
+
+void uthread_trace_stop(void)
+{
+	atomic_store(&trace_on, 0);
+}
+
+static const char *reason_names[] = {"yield", "preempt", "block", "exit"};
+
+/* Write the retained records of worker @worker's ring to @f */
+static void trace_dump_ring(FILE *f, int worker, uint64_t base, int *first)
+{
+	struct trace_ring *ring = &atomic_load(&rings)[worker];
+	uint64_t start = ring->head > ring_size ? ring->head - ring_size : 0;
+	int running = 0; // whether a slice was opened on the track
+	int pid = getpid();
+
+	fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+		"\"args\":{\"name\":\"worker %d\"}}", *first ? "" : ",\n", pid, worker, worker);
+	*first = 0;
+
+	for (uint64_t i = start; i < ring->head; i++) {
+		struct trace_record *rec = &ring->records[i & ring->mask];
+		double ts = stats_ns(rec->time - base) / 1e3;
+
+		switch (rec->type) {
+		case TRACE_SWITCH:
+			// Records overwritten by newer ones may have opened the slice
+			if (rec->tid != TRACE_IDLE && running) {
+				fprintf(f, ",\n{\"name\":\"thread %u\",\"ph\":\"E\",\"ts\":%.3f,"
+					"\"pid\":%d,\"tid\":%d,\"args\":{\"reason\":\"%s\"}}",
+					rec->tid, ts, pid, worker, reason_names[rec->arg]);
+			}
+			running = rec->next != TRACE_IDLE;
+			if (running) {
+				fprintf(f, ",\n{\"name\":\"thread %u\",\"ph\":\"B\",\"ts\":%.3f,"
+					"\"pid\":%d,\"tid\":%d}", rec->next, ts, pid, worker);
+			}
+			break;
+		case TRACE_EXIT:
+			fprintf(f, ",\n{\"name\":\"exit\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"tid\":%u,\"retval\":%d}}",
+				ts, pid, worker, rec->tid, rec->arg);
+			break;
+		default:
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"tid\":%u}}",
+				rec->type == TRACE_CREATE ? "create" : "wake",
+				ts, pid, worker, rec->tid);
+			break;
+		}
+	}
+}
+
+int uthread_trace_dump(const char *path)
+{
+	struct trace_ring *all = atomic_load(&rings);
+	uint64_t base = UINT64_MAX;
+	int first = 1;
+	FILE *f;
+
+	if (path == NULL || all == NULL || atomic_load(&trace_on)) return -1;
+	trace_quiesce();
+
+	// Time 0 is that of the oldest record retained
+	for (int i = 0; i < nr_rings; i++) {
+		struct trace_ring *ring = &all[i];
+		uint64_t start = ring->head > ring_size ? ring->head - ring_size : 0;
+
+		if (start < ring->head && ring->records[start & ring->mask].time < base)
+			base = ring->records[start & ring->mask].time;
+	}
+
+	f = fopen(path, "w");
+	if (f == NULL) return -1;
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (int i = 0; i < nr_rings; i++)
+		trace_dump_ring(f, i, base, &first);
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,73 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+ * This header is only meant to be included by files from the libuthread. It
+ * provides the scheduling event trace: while tracing is on, the scheduler
+ * records its events into a ring buffer per worker, which only the worker's
+ * kernel thread writes to. Recording never allocates nor takes a lock, and
+ * overwrites the oldest events once the buffer is full. While tracing is off,
+ * TRACE() only costs a test of a global flag.
+ *
+ * Events must be recorded with preemption disabled, by the worker the calling
+ * thread runs on.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "uthread.h"
+
+enum trace_type {
+	TRACE_CREATE, // a thread was created
+	TRACE_SWITCH, // the worker switched from a thread to another
+	TRACE_WAKE, // a blocked thread was made ready
+	TRACE_EXIT, // a thread exited
+};
+
+/* Why a thread was switched out */
+enum trace_reason {
+	TRACE_YIELD,
+	TRACE_PREEMPT,
+	TRACE_BLOCK,
+	TRACE_EXITED,
+};
+
+/* TID standing for the worker's idle loop in switch events */
+#define TRACE_IDLE ((uthread_t)-1)
+
+extern atomic_int trace_on;
+
+/* Run @call, a call to a trace function, if tracing is on */
+#define TRACE(call) do {						\
+	if (atomic_load_explicit(&trace_on, memory_order_relaxed))	\
+		call;							\
+} while (0)
+
+/*
+ * trace_event - Record an event
+ * @worker: Number of the calling worker
+ * @type: Type of the event, but TRACE_SWITCH
+ * @tid: Thread the event is about
+ * @arg: Return value for TRACE_EXIT, 0 otherwise
+ */
+void trace_event(int worker, enum trace_type type, uthread_t tid, int arg);
+
+/*
+ * trace_switch - Record a context switch
+ * @worker: Number of the calling worker
+ * @prev: Thread switched out, or TRACE_IDLE
+ * @next: Thread switched in, or TRACE_IDLE
+ * @reason: Why @prev was switched out
+ */
+void trace_switch(int worker, uthread_t prev, uthread_t next, enum trace_reason reason);
+
+/*
+ * trace_free - Stop tracing and release the buffers
+ *
+ * Release the buffers of the previous traces as well. To be called when the
+ * library stops, once the other workers are done.
+ */
+void trace_free(void);
+
+#endif /* _TRACE_H */
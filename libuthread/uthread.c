@@ -1,207 +1,1405 @@
+#define _GNU_SOURCE
 #include <assert.h>
-#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
 
+#include "iqueue.h"
 #include "private.h"
-#include "queue.h"
+#include "spinlock.h"
+#include "stats.h"
+#include "trace.h"
 #include "uthread.h"
 
 #define NUM_QUEUES 3
 
 enum state{READY, BLOCKED, ZOMBIE, RUNNING};
 
+/*
+ * TIDs are handles into the thread table: the low TID_SLOT_BITS bits are the
+ * index of the thread's slot and the bits above are the generation of that
+ * slot. A slot's generation is bumped every time the slot is released, so a
+ * stale TID of a collected thread never matches the thread reusing its slot.
+ */
+#define TID_SLOT_BITS 20
+#define TID_GEN_BITS 11 // keep TIDs positive when returned as an int
+#define TID_SLOT_MASK ((1u << TID_SLOT_BITS) - 1)
+#define TID_GEN_MASK ((1u << TID_GEN_BITS) - 1)
+#define MAX_THREADS (1u << TID_SLOT_BITS)
+#define THR_TABLE_INIT_SIZE 64
+
+/* Number of yields between two polls for I/O readiness by a busy worker */
+#define IO_POLL_INTERVAL 64
+
+#ifdef UTHREAD_STATS
+/* Statistics of a thread, with durations in stats_clock() ticks */
+struct thr_stats {
+	unsigned long nr_voluntary;
+	unsigned long nr_involuntary;
+	uint64_t run;
+	uint64_t ready;
+	uint64_t since; // when the thread last started running or became ready
+};
+#endif
+
 typedef struct tcb {
 	uthread_t tid;
 	int state;
 	uthread_ctx_t ctx;
-	void *stack;
+	uthread_stack_t stack;
+	uthread_func_t func;
 	int retval;
-	uthread_t joining_thr_tid; // tid of calling thread that joined it
+	struct tcb *joining_thr; // calling thread that joined it, if any
+	struct worker *home; // worker the thread is pinned to, NULL if it can migrate
+	int base_prio; // priority set by the user
+	int prio; // current priority, lowered from @base_prio by the MLFQ mode
+	struct worker *rq; // worker whose ready queue holds the thread, if any
+	int rq_level; // priority level of that ready queue
+	struct iqueue_node link; // links into the queue of its current state
+	void *arg; // argument given to uthread_create_n(), NULL otherwise
+	struct tcb_block *block; // block the TCB was allocated in, NULL if on its own
+	int detached; // whether it gets collected as soon as it exits
+#ifdef UTHREAD_STATS
+	struct thr_stats stats;
+#endif
 } tcb;
 
 typedef tcb* tcb_t;
 
-uthread_t num_thr = 0; // number of threads created 
-queue_t scheduler[NUM_QUEUES];
+/*
+ * TCBs of the threads created together by uthread_create_n(), allocated as a
+ * single block which is freed once all of them are collected
+ */
+struct tcb_block {
+	atomic_int nr_live;
+	tcb thrs[];
+};
+
+struct thr_slot {
+	tcb_t thr; // thread occupying the slot, NULL if free
+	unsigned int gen; // generation of the next TID handed out for this slot
+	unsigned int next_free; // next slot in the free list (0 terminates it)
+};
+
+/*
+ * Ready queue, with one FIFO per priority level. A bitmap tracks the levels
+ * which are not empty, so that the highest priority ready thread is found with
+ * a single find-first-set.
+ */
+struct runq {
+	uint32_t bitmap; // bit i is set if level i is not empty
+	struct iqueue level[UTHREAD_PRIO_LEVELS];
+#ifdef UTHREAD_STATS
+	unsigned int len; // number of threads in all the levels
+	unsigned int max_len;
+#endif
+};
+
+/*
+ * Workers
+ *
+ * A worker is a kernel thread running user threads. By default, the process'
+ * original thread is the only worker. In M:N mode, additional pthread workers
+ * are launched: each worker has its own ready queue, and a worker whose ready
+ * queue is empty steals the oldest ready thread of another worker. The main
+ * thread is pinned to the original worker, so that it always returns to the
+ * process' original stack and kernel thread.
+ *
+ * Threads are switched to each other directly. Since another worker may resume
+ * a thread as soon as it appears in a ready queue (or can be woken up), what
+ * the previous thread needs once it is switched out (being put back into a
+ * ready queue, releasing the scheduler lock) is done by finish_switch() from
+ * the context of the next thread. When a worker has nothing to run, it
+ * switches to its idle context, which looks for work and parks the kernel
+ * thread until some shows up.
+ *
+ * Preemption is tickless: a worker's timer is only armed while there is
+ * another thread in its ready queue which the running thread could be
+ * preempted for. It gets armed as soon as a thread is added to the ready
+ * queue, and disarmed once the running thread is found to be alone at the next
+ * tick. Yielding does not disarm it, as threads which block and wake each other
+ * up often leave the ready queue empty for a short while only.
+ */
+struct worker {
+	int id;
+	pthread_t pthread;
+	spinlock_t lock; // protects @runq in M:N mode
+	struct runq runq; // threads ready to run on this worker
+	tcb_t curr; // thread currently running on this worker
+	tcb_t prev; // thread switched out, pending finish_switch()
+	int prev_locked; // whether @prev holds the scheduler lock
+	tcb_t idle; // context of the worker's idle loop
+	int ticking; // whether the preemption timer is armed, protected by @lock
+	unsigned int io_yields; // yields since the worker last polled for I/O
+	int preempting; // whether the current thread is being switched out by the timer
+	void *sigstack; // alternate signal stack, on which stack faults are handled
+};
+
+struct thr_slot *thr_table;
+unsigned int thr_table_size; // number of allocated slots
+unsigned int thr_table_used; // number of slots ever handed out
+unsigned int thr_table_free; // head of the free slot list (0 if empty)
+unsigned int nr_live_thr; // threads not collected yet, main thread included
+
+struct iqueue scheduler[NUM_QUEUES]; // the READY queues live in the workers
+/*
+ * TCBs of exited detached threads, reused by the next threads created. They
+ * are released on the switch out of their thread, where calling free() could
+ * deadlock on an allocator lock held by a thread preempted within malloc().
+ */
+struct iqueue dead_thrs;
 tcb_t main_thr; // main thread
-tcb_t curr_thr; // currently active and running thread
 int scheduler_preempt;
+int scheduler_mlfq;
+#ifdef UTHREAD_STATS
+unsigned long nr_creates, nr_joins; // protected by the scheduler lock
+#endif
+
+struct worker *workers;
+int nr_workers;
+static __thread struct worker *this_worker; // worker of the calling kernel thread
+
+/*
+ * In M:N mode, the scheduler lock protects the thread table and the BLOCKED
+ * and ZOMBIE queues. Idle workers park on @park_cond.
+ */
+spinlock_t sched_spinlock = SPINLOCK_INIT;
+pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+atomic_int nr_parked;
+atomic_int workers_stopping;
+
+/*
+ * Threads waiting for I/O are woken up by polling for readiness: an idle worker
+ * becomes the poller and blocks until a descriptor gets ready, in which case
+ * new work for it or for a parked worker interrupts the poll. Busy workers also
+ * poll (without blocking) every IO_POLL_INTERVAL yields and whenever preempted,
+ * so that threads waiting for I/O, offloaded calls or deadlines do not starve
+ * while threads are ready.
+ */
+_Atomic(struct worker *) io_poller;
+
+void uthread_sched_lock(void)
+{
+	preempt_disable();
+	if (nr_workers > 1) spin_lock(&sched_spinlock);
+}
+
+void uthread_sched_unlock(void)
+{
+	if (nr_workers > 1) spin_unlock(&sched_spinlock);
+	preempt_enable();
+}
+
+/* Wake up parked workers, if any, so that they look for work */
+static void wake_workers(void)
+{
+	if (atomic_load(&nr_parked) == 0) return;
+
+	pthread_mutex_lock(&park_mutex);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_mutex);
+}
+
+static void runq_lock(struct worker *w)
+{
+	if (nr_workers > 1) spin_lock(&w->lock);
+}
+
+static void runq_unlock(struct worker *w)
+{
+	if (nr_workers > 1) spin_unlock(&w->lock);
+}
+
+/* Link @thr into the ready queue of worker @w, which must be locked */
+static void runq_add(struct worker *w, tcb_t thr)
+{
+	thr->rq = w;
+	thr->rq_level = thr->prio;
+	iqueue_enqueue(&w->runq.level[thr->rq_level], &thr->link);
+	w->runq.bitmap |= 1u << thr->rq_level;
+	STATS(if (++w->runq.len > w->runq.max_len) w->runq.max_len = w->runq.len);
+
+	// The running thread now has a competitor, start ticking. A worker which
+	// has not created its timer yet arms it once created.
+	if (!w->ticking && scheduler_preempt && preempt_timer_set(w->id, 1) == 0) {
+		w->ticking = 1;
+	}
+}
+
+/* Unlink @thr from the ready queue of worker @w, which must be locked */
+static void runq_del(struct worker *w, tcb_t thr)
+{
+	struct iqueue *level = &w->runq.level[thr->rq_level];
+
+	iqueue_delete(level, &thr->link);
+	if (iqueue_length(level) == 0) w->runq.bitmap &= ~(1u << thr->rq_level);
+	thr->rq = NULL;
+	STATS(w->runq.len--);
+}
+
+/* Interrupt the worker blocked polling for I/O if it has to run new work */
+static void io_kick(struct worker *w)
+{
+	struct worker *poller;
+
+	atomic_thread_fence(memory_order_seq_cst); // the work is visible to the poller
+	poller = atomic_load(&io_poller);
+	if (poller && poller != this_worker && (poller == w || atomic_load(&nr_parked) == 0)) {
+		io_interrupt();
+	}
+}
+
+static void runq_push(struct worker *w, tcb_t thr)
+{
+	runq_lock(w);
+	runq_add(w, thr);
+	runq_unlock(w);
+	if (nr_workers > 1) {
+		wake_workers();
+		io_kick(w);
+	}
+}
+
+/* Pop the oldest thread of the highest level of @w, if not below @limit */
+static tcb_t runq_pop(struct worker *w, int limit)
+{
+	tcb_t thr = NULL;
+
+	runq_lock(w);
+	if (w->runq.bitmap) {
+		int prio = __builtin_ctz(w->runq.bitmap);
+		if (prio <= limit) {
+			thr = iqueue_entry(w->runq.level[prio].head.next, tcb, link);
+			runq_del(w, thr);
+		}
+	}
+	runq_unlock(w);
+
+	return thr;
+}
+
+/*
+ * Steal the oldest thread that can migrate from the highest priority level of
+ * another worker's ready queue, if not below @limit
+ */
+static tcb_t runq_steal(struct worker *thief, int limit)
+{
+	for (int i = 1; i < nr_workers; i++) {
+		struct worker *victim = &workers[(thief->id + i) % nr_workers];
+		tcb_t thr = NULL;
+
+		spin_lock(&victim->lock);
+		for (uint32_t levels = victim->runq.bitmap; levels && !thr; levels &= levels - 1) {
+			int prio = __builtin_ctz(levels);
+			struct iqueue_node *pos, *tmp;
+
+			if (prio > limit) break;
+			iqueue_for_each(pos, tmp, &victim->runq.level[prio]) {
+				tcb_t candidate = iqueue_entry(pos, tcb, link);
+				if (candidate->home == NULL) {
+					runq_del(victim, candidate);
+					thr = candidate;
+					break;
+				}
+			}
+		}
+		spin_unlock(&victim->lock);
+
+		if (thr) return thr;
+	}
+
+	return NULL;
+}
+
+/* Stop the timer of worker @w if its ready queue is empty */
+static void tick_stop(struct worker *w)
+{
+	if (!w->ticking) return;
+
+	runq_lock(w);
+	if (w->ticking && w->runq.bitmap == 0) {
+		w->ticking = 0;
+		preempt_timer_set(w->id, 0);
+	}
+	runq_unlock(w);
+}
+
+/* Create the timer of worker @w, armed if work was pushed to it already */
+static void tick_start(struct worker *w)
+{
+	if (preempt_thread_start(w->id) == -1) return;
+
+	runq_lock(w);
+	if (!w->ticking && w->runq.bitmap && preempt_timer_set(w->id, 1) == 0) {
+		w->ticking = 1;
+	}
+	runq_unlock(w);
+}
+
+void uthread_tick_stop(void)
+{
+	if (this_worker) tick_stop(this_worker); // unless a foreign kernel thread
+}
+
+/*
+ * Next thread for worker @w to run, or NULL if there is none with a priority of
+ * at least @limit
+ */
+static tcb_t pick_next(struct worker *w, int limit)
+{
+	tcb_t next = runq_pop(w, limit);
+
+	if (next == NULL && nr_workers > 1) next = runq_steal(w, limit);
+	return next;
+}
+
+/* Make thread @thr ready to run, on its home worker if it is pinned */
+static void make_ready(tcb_t thr)
+{
+	thr->state = READY;
+	STATS(thr->stats.since = stats_clock());
+	runq_push(thr->home ? thr->home : this_worker, thr);
+}
+
+/*
+ * Make the @n new threads of @thrs ready to run, spread over the ready queues
+ * of all the workers starting with the calling one's, each queue being locked
+ * only once
+ */
+static void make_ready_n(tcb_t thrs, int n)
+{
+	for (int i = 0; i < nr_workers && i < n; i++) {
+		struct worker *w = &workers[(this_worker->id + i) % nr_workers];
+
+		runq_lock(w);
+		for (int j = i; j < n; j += nr_workers) {
+			thrs[j].state = READY;
+			STATS(thrs[j].stats.since = stats_clock());
+			runq_add(w, &thrs[j]);
+		}
+		runq_unlock(w);
+		if (nr_workers > 1) io_kick(w);
+	}
+	if (nr_workers > 1) wake_workers();
+}
+
+/* Free the TCB of a collected thread */
+static void thr_free(tcb_t thr)
+{
+	struct tcb_block *block = thr->block;
+
+	if (block == NULL) free(thr);
+	else if (atomic_fetch_sub(&block->nr_live, 1) == 1) free(block);
+}
 
-/** 
- * Finds thread that has TID @tid_to_find 
- * @return 0 if no match; 1 if match found
+/*
+ * Allocate the TCB of a new thread, reusing that of an exited detached thread
+ * if any. A reused TCB may still belong to a block, which it keeps alive.
+ */
+static tcb_t thr_alloc(void)
+{
+	struct iqueue_node *node;
+	tcb_t thr;
+
+	uthread_sched_lock();
+	node = iqueue_dequeue(&dead_thrs);
+	uthread_sched_unlock();
+	if (node) return iqueue_entry(node, tcb, link);
+
+	thr = malloc(sizeof(tcb));
+	if (thr) thr->block = NULL;
+	return thr;
+}
+
+/* Complete the switch out of the worker's previous thread (see struct worker) */
+static void finish_switch(void)
+{
+	struct worker *w = this_worker;
+	tcb_t prev = w->prev;
+
+	w->prev = NULL;
+	if (prev->state == READY && prev != w->idle) {
+		runq_push(prev->home ? prev->home : w, prev);
+	} else if (prev->state == ZOMBIE && prev->detached) {
+		// Off its stack at last, still under the lock it exited with
+		uthread_ctx_destroy_stack(&prev->stack);
+		iqueue_enqueue(&dead_thrs, &prev->link);
+	}
+	if (w->prev_locked && nr_workers > 1) spin_unlock(&sched_spinlock);
+}
+
+#ifdef UTHREAD_STATS
+/* Account for the switch of worker @w from thread @prev to thread @next */
+static void stats_switch(struct worker *w, tcb_t prev, tcb_t next)
+{
+	uint64_t now = stats_clock();
+
+	prev->stats.run += now - prev->stats.since;
+	prev->stats.since = now; // waiting from now on if it is ready
+	if (w->preempting) prev->stats.nr_involuntary++;
+	else prev->stats.nr_voluntary++;
+	next->stats.ready += now - next->stats.since;
+	next->stats.since = now;
+}
+#endif
+
+/* Record the switch of worker @w from thread @prev to thread @next */
+static void trace_switch_to(struct worker *w, tcb_t prev, tcb_t next)
+{
+	enum trace_reason reason;
+
+	if (prev->state == READY) reason = w->preempting ? TRACE_PREEMPT : TRACE_YIELD;
+	else reason = prev->state == BLOCKED ? TRACE_BLOCK : TRACE_EXITED;
+	trace_switch(w->id, prev == w->idle ? TRACE_IDLE : prev->tid,
+		     next == w->idle ? TRACE_IDLE : next->tid, reason);
+}
+
+/* Switch from the current thread of worker @w to thread @next */
+static void switch_to(struct worker *w, tcb_t next, int locked)
+{
+	tcb_t prev = w->curr;
+
+	STATS(stats_switch(w, prev, next));
+	TRACE(trace_switch_to(w, prev, next));
+	w->preempting = 0;
+	w->prev = prev;
+	w->prev_locked = locked;
+	w->curr = next;
+	next->state = RUNNING;
+	preempt_take_pending(); // @next starts a new time slice
+	uthread_ctx_switch(&prev->ctx, &next->ctx);
+}
+
+/**
+ * Switches the current thread out for the next ready thread
+ * @locked: whether the caller holds the scheduler lock
+ *
+ * Must be called with preemption disabled, once the current thread has set its
+ * own state: READY to be put back into the ready queue, or BLOCKED/ZOMBIE (with
+ * the scheduler lock held) if it waits for another thread. Returns once the
+ * current thread runs again, with preemption enabled and the lock released.
  **/
-int find_thread(queue_t q, void *data, void *tid_to_find)
+static void schedule(int locked)
 {
-	if (data == NULL || tid_to_find == NULL) return 0;
+	struct worker *w = this_worker;
+	tcb_t prev = w->curr;
+	// A thread which can keep running only gives way to threads of its level
+	tcb_t next = pick_next(w, prev->state == READY ? prev->prio : UTHREAD_PRIO_LEVELS - 1);
 
-	uthread_t tid = *(uthread_t*)tid_to_find;
-	tcb_t thr = (tcb_t)data;
-	(void)q; // unused
+	if (next == NULL) {
+		if (prev->state == READY) { // nothing else to run, keep going
+			prev->state = RUNNING;
+			w->preempting = 0;
+			if (locked) uthread_sched_unlock();
+			else preempt_enable();
+			return;
+		}
+		next = w->idle;
+	}
 
-	if (thr->tid == tid) { // tid match found
-		return 1;
+	switch_to(w, next, locked);
+	finish_switch();
+	preempt_enable();
+}
+
+/* Whether any worker has a thread ready to run */
+static int has_ready_thr(void)
+{
+	int ready = 0;
+
+	for (int i = 0; i < nr_workers && !ready; i++) {
+		spin_lock(&workers[i].lock);
+		ready = workers[i].runq.bitmap != 0;
+		spin_unlock(&workers[i].lock);
+	}
+
+	return ready;
+}
+
+/* Park the calling worker until there may be work for it */
+static void park_worker(void)
+{
+	pthread_mutex_lock(&park_mutex);
+	atomic_fetch_add(&nr_parked, 1);
+	// Check again once registered, so that a concurrent wakeup is not missed.
+	// Some worker must also stay up to poll for I/O.
+	if (!has_ready_thr() && !atomic_load(&workers_stopping)
+	    && !(io_waiting() && atomic_load(&io_poller) == NULL)) {
+		pthread_cond_wait(&park_cond, &park_mutex);
 	}
+	atomic_fetch_sub(&nr_parked, 1);
+	pthread_mutex_unlock(&park_mutex);
+}
+
+/**
+ * Idle loop of a worker, run with preemption disabled whenever none of its
+ * threads can run. Only returns when the library stops.
+ **/
+static int worker_idle(void)
+{
+	struct worker *w = this_worker;
+
+	for (;;) {
+		if (w->prev) finish_switch(); // switched from a thread out of work
+
+		tcb_t next = pick_next(w, UTHREAD_PRIO_LEVELS - 1);
+		if (next) {
+			switch_to(w, next, 0);
+			continue;
+		}
+
+		tick_stop(w); // nothing to preempt while idle
+		if (atomic_load(&workers_stopping)) return 0;
+		if (io_waiting()) {
+			struct worker *none = NULL;
+
+			if (atomic_compare_exchange_strong(&io_poller, &none, w)) {
+				// Work pushed from now on interrupts the poll
+				if (!has_ready_thr()) io_poll(-1);
+				atomic_store(&io_poller, NULL);
+				continue;
+			}
+		}
+		if (nr_workers == 1) { // no other kernel thread can wake anyone up
+			fprintf(stderr, "uthread: deadlock, all threads are blocked\n");
+			abort();
+		}
+		park_worker();
+	}
+}
+
+/*
+ * Stack faults
+ *
+ * Growable stacks fault when the thread goes deeper than what they committed
+ * so far. Since the thread's stack is what overflowed, SIGSEGV is handled on an
+ * alternate signal stack, one per worker. The faulting thread is normally the
+ * current one, but may also be the one being switched out, pushing its last
+ * registers on its stack. Any other SIGSEGV, be it a fault of another kind or
+ * a signal sent by a process, is passed on to the previous action, which is
+ * called from the handler (or, if it is the default one, the signal raised
+ * again with the default disposition, killing the process).
+ *
+ * When the kernel cannot push the frame of a signal (the preemption timer's)
+ * on a stack, it raises a SIGSEGV of its own instead, without any address:
+ * room for a frame is then made below the stack pointer, the signal being lost.
+ * Other faults without an address, such as general protection faults, are
+ * only mistaken for it with the stack pointer that close to the limit, and
+ * then fault again once the stack grew, so they are never hidden.
+ */
+static struct sigaction old_segv_act;
+static stack_t old_sigstack; // of the process' original thread
+
+/* Size of the signal stacks, on which the previous SIGSEGV handler runs too */
+#define SIGNAL_STACK_SIZE (8 * SIGSTKSZ)
+
+/* Stack pointer of the context interrupted by a signal, NULL if unknown */
+static void *signal_sp(void *ucontext)
+{
+#if defined(__x86_64__)
+	return (void *)((ucontext_t *)ucontext)->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	return (void *)((ucontext_t *)ucontext)->uc_mcontext.sp;
+#else
+	(void)ucontext;
+	return NULL;
+#endif
+}
+
+/*
+ * Whether a signal frame pushed at @sp would not fit on the stack of @thr: @sp
+ * is within the part of the stack which may grow, right above what is not
+ * accessible yet
+ */
+static int frame_overflows(tcb_t thr, char *sp)
+{
+	const uthread_stack_t *stack = &thr->stack;
+	char *base = stack->base;
+
+	return base && stack->max > stack->size
+		&& sp >= base + stack->size - stack->max && sp <= base + stack->size
+		&& sp < base + SIGSTKSZ;
+}
+
+/* Pass a SIGSEGV the library does not handle on to the previous action */
+static void stack_fault_chain(int sig, siginfo_t *info, void *ucontext)
+{
+	struct sigaction dfl = {.sa_handler = SIG_DFL};
+	sigset_t mask;
+
+	if (!(old_segv_act.sa_flags & SA_SIGINFO)) {
+		if (old_segv_act.sa_handler == SIG_IGN && info->si_code <= 0) return;
+		if (old_segv_act.sa_handler == SIG_DFL || old_segv_act.sa_handler == SIG_IGN) {
+			// Kill the process, even for an ignored fault as the kernel
+			// would. The signal stays blocked, thus pending, until the
+			// handler returns.
+			sigaction(SIGSEGV, &dfl, NULL);
+			raise(SIGSEGV);
+			return;
+		}
+	}
+
+	pthread_sigmask(SIG_BLOCK, &old_segv_act.sa_mask, &mask);
+	if (old_segv_act.sa_flags & SA_SIGINFO) old_segv_act.sa_sigaction(sig, info, ucontext);
+	else old_segv_act.sa_handler(sig);
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+}
+
+static void stack_fault(int sig, siginfo_t *info, void *ucontext)
+{
+	struct worker *w = this_worker;
+	tcb_t thr = NULL;
+
+	if (w && info->si_code == SI_KERNEL) {
+		// General protection faults and such raise the same signal, only a
+		// stack pointer about to run out of stack tells a signal frame apart
+		char *sp = signal_sp(ucontext);
+
+		if (sp && w->curr && frame_overflows(w->curr, sp)) thr = w->curr;
+		else if (sp && w->prev && frame_overflows(w->prev, sp)) thr = w->prev;
+		if (thr && uthread_ctx_stack_grow(&thr->stack, sp, SIGSTKSZ) == 0) return;
+	} else if (w && info->si_code > 0 // sent by the kernel, @si_addr is meaningful
+		   && ((w->curr && uthread_ctx_stack_grow(&w->curr->stack, info->si_addr, 0) == 0)
+		       || (w->prev && uthread_ctx_stack_grow(&w->prev->stack, info->si_addr, 0) == 0))) {
+		return;
+	}
+
+	stack_fault_chain(sig, info, ucontext);
+}
+
+/* Give the calling kernel thread, which runs worker @w, its signal stack */
+static int stack_fault_thread_start(struct worker *w)
+{
+	stack_t ss;
+
+	w->sigstack = malloc(SIGNAL_STACK_SIZE);
+	if (w->sigstack == NULL) return -1;
+	ss.ss_sp = w->sigstack;
+	ss.ss_size = SIGNAL_STACK_SIZE;
+	ss.ss_flags = 0;
+
+	return sigaltstack(&ss, w->id == 0 ? &old_sigstack : NULL);
+}
+
+static int stack_fault_start(void)
+{
+	struct sigaction act;
+
+	act.sa_sigaction = stack_fault;
+	// Preempting the handler would switch threads on the signal stack
+	sigemptyset(&act.sa_mask);
+	sigaddset(&act.sa_mask, SIGVTALRM);
+	act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	if (sigaction(SIGSEGV, &act, &old_segv_act) == -1) return -1;
+
+	return stack_fault_thread_start(&workers[0]);
+}
+
+static void stack_fault_stop(void)
+{
+	sigaltstack(&old_sigstack, NULL);
+	sigaction(SIGSEGV, &old_segv_act, NULL);
+	for (int i = 0; i < nr_workers; i++)
+		free(workers[i].sigstack);
+}
+
+/* Entry point of the additional pthread workers of the M:N mode */
+static void *worker_main(void *arg)
+{
+	preempt_disable(); // the idle loop always runs with preemption disabled
+	this_worker = arg;
+	this_worker->curr = this_worker->idle; // the idle loop runs on the pthread's stack
+	// Without a signal stack, its threads' stacks growing would be fatal
+	stack_fault_thread_start(this_worker);
+	// Without a timer of its own, the worker simply never gets preempted
+	if (scheduler_preempt) tick_start(this_worker);
+	worker_idle();
+
+	return NULL;
+}
+
+/* Entry point of every new thread */
+static int thread_start(void)
+{
+	/*
+	 * Complete the switch from the previous thread and enable interrupts
+	 * right after being elected to run for the first time
+	 */
+	finish_switch();
+	preempt_enable();
+
+	return this_worker->curr->func();
+}
 
+/**
+ * Assigns a free slot of the thread table to @thr and sets its TID
+ * @return 0 on success; -1 if the table is full or cannot grow
+ **/
+static int thr_table_insert(tcb_t thr)
+{
+	unsigned int slot;
+
+	if (thr_table_free != 0) { // recycle a released slot
+		slot = thr_table_free;
+		thr_table_free = thr_table[slot].next_free;
+	} else {
+		if (thr_table_used == MAX_THREADS) return -1;
+		if (thr_table_used == thr_table_size) { // double the table
+			unsigned int size = thr_table_size ? thr_table_size * 2 : THR_TABLE_INIT_SIZE;
+			struct thr_slot *table = realloc(thr_table, size * sizeof(*table));
+			if (table == NULL) return -1;
+			thr_table = table;
+			thr_table_size = size;
+		}
+		slot = thr_table_used++;
+		thr_table[slot].gen = 0;
+	}
+
+	thr_table[slot].thr = thr;
+	thr->tid = (thr_table[slot].gen << TID_SLOT_BITS) | slot;
+	nr_live_thr++;
 	return 0;
 }
 
+/* Releases the slot of @thr so that it can be reused by a future thread */
+static void thr_table_remove(tcb_t thr)
+{
+	unsigned int slot = thr->tid & TID_SLOT_MASK;
+
+	thr_table[slot].thr = NULL;
+	thr_table[slot].gen = (thr_table[slot].gen + 1) & TID_GEN_MASK;
+	thr_table[slot].next_free = thr_table_free;
+	thr_table_free = slot;
+	nr_live_thr--;
+}
+
+/**
+ * Finds thread that has TID @tid in constant time
+ * @return NULL if no match; matching thread otherwise
+ **/
+static tcb_t thr_table_lookup(uthread_t tid)
+{
+	unsigned int slot = tid & TID_SLOT_MASK;
+	tcb_t thr;
+
+	if (slot >= thr_table_used) return NULL;
+	thr = thr_table[slot].thr;
+	if (thr == NULL || thr->tid != tid) return NULL; // free slot or stale TID
+
+	return thr;
+}
+
+void uthread_opts_init(uthread_opts_t *opts)
+{
+	opts->preempt = 0;
+	opts->nr_workers = 1;
+	opts->mlfq = 0;
+	opts->quantum_us = UTHREAD_QUANTUM_DEFAULT;
+	opts->clock = CLOCK_THREAD_CPUTIME_ID;
+}
+
 int uthread_start(int preempt)
 {
-	// Create queues
+	uthread_opts_t opts;
+
+	uthread_opts_init(&opts);
+	opts.preempt = preempt;
+	return uthread_start_opts(&opts);
+}
+
+int uthread_start_opts(const uthread_opts_t *opts)
+{
+	int n = opts->nr_workers > 0 ? opts->nr_workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	// Initialize queues
 	for (int i = 0; i < NUM_QUEUES; i++) {
-		scheduler[i] = queue_create();
-		if (scheduler[i] == NULL) {
-			return -1;
+		iqueue_init(&scheduler[i]);
+	}
+	iqueue_init(&dead_thrs);
+	STATS(nr_creates = nr_joins = 0);
+
+	// Initialize workers, the calling kernel thread being the first one
+	workers = calloc(n, sizeof(struct worker));
+	if (workers == NULL) return -1;
+	nr_workers = n;
+	for (int i = 0; i < n; i++) {
+		workers[i].id = i;
+		spin_init(&workers[i].lock);
+		workers[i].runq.bitmap = 0;
+		for (int prio = 0; prio < UTHREAD_PRIO_LEVELS; prio++) {
+			iqueue_init(&workers[i].runq.level[prio]);
 		}
+		workers[i].idle = calloc(1, sizeof(tcb));
+		if (workers[i].idle == NULL) return -1;
+		workers[i].idle->state = RUNNING;
+	}
+	this_worker = &workers[0];
+
+	// The original worker's idle loop needs a stack of its own
+	if (uthread_ctx_alloc_stack(&workers[0].idle->stack, UTHREAD_STACK_SIZE, 0, UTHREAD_GUARD_SIZE) == -1
+	    || uthread_ctx_init(&workers[0].idle->ctx, &workers[0].idle->stack, worker_idle) == -1) {
+		return -1;
 	}
 
-	// "Initialize" main thread
+	// "Initialize" main thread, which always gets slot 0 and thus TID 0
+	thr_table = NULL;
+	thr_table_size = thr_table_used = thr_table_free = nr_live_thr = 0;
 	main_thr = malloc(sizeof(tcb));
 	if (main_thr == NULL) return -1;
-	main_thr->tid = num_thr;
+	if (thr_table_insert(main_thr) == -1) return -1;
 	main_thr->state = RUNNING;
-	main_thr->stack = uthread_ctx_alloc_stack();
-	if (main_thr->stack == NULL) return -1;
+	main_thr->joining_thr = NULL;
+	main_thr->home = &workers[0];
+	main_thr->base_prio = main_thr->prio = UTHREAD_PRIO_DEFAULT;
+	main_thr->rq = NULL;
+	main_thr->arg = NULL;
+	main_thr->block = NULL;
+	main_thr->detached = 0;
+	STATS(main_thr->stats = (struct thr_stats){.since = stats_clock()});
+	main_thr->stack.base = NULL; // runs on the process' own stack
 	
 	// Set current active thread to main thread
-	curr_thr = main_thr;
+	workers[0].curr = main_thr;
+
+	scheduler_mlfq = opts->mlfq;
+
+	if (sleep_start() == -1 || io_start() == -1 || stack_fault_start() == -1) return -1;
+	atomic_store(&io_poller, NULL);
+	offload_start();
 
 	// Check if preemption was enabled
-	if ((scheduler_preempt = preempt)) preempt_start();
+	if ((scheduler_preempt = opts->preempt)) {
+		unsigned int quantum = opts->quantum_us ? opts->quantum_us : UTHREAD_QUANTUM_DEFAULT;
+
+		if (preempt_start(scheduler_preempt == UTHREAD_PREEMPT_POLL, quantum,
+				  opts->clock, n) == -1
+		    || preempt_thread_start(0) == -1) {
+			return -1;
+		}
+	}
+
+	// Launch the other workers, which start their own preemption timers
+	atomic_store(&workers_stopping, 0);
+	for (int i = 1; i < n; i++) {
+		if (pthread_create(&workers[i].pthread, NULL, worker_main, &workers[i])) {
+			return -1;
+		}
+	}
 
 	return 0;
 }
 
 int uthread_stop(void)
 {
+	struct iqueue_node *node;
+
 	// Disable preemption if needed
-	if (scheduler_preempt == 1) preempt_stop();
+	if (scheduler_preempt) {
+		preempt_stop();
+		scheduler_preempt = 0;
+	}
 
-	if (curr_thr->tid != main_thr->tid) return -1;
+	if (this_worker->curr != main_thr) return -1;
 
 	// Check if there are still threads left
-	if (queue_length(scheduler[READY]) > 0 || queue_length(scheduler[ZOMBIE]) > 0 || queue_length(scheduler[BLOCKED]) > 0) {
+	uthread_sched_lock();
+	if (nr_live_thr > 1) {
+		uthread_sched_unlock();
 		return -1;
 	}
+	atomic_store(&workers_stopping, 1);
+	uthread_sched_unlock();
 
-	for (int i = 0; i < NUM_QUEUES; i++) {
-		queue_destroy(scheduler[i]);
+	// Stop the other workers, which are all idle by now
+	pthread_mutex_lock(&park_mutex);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_mutex);
+	io_interrupt();
+	for (int i = 1; i < nr_workers; i++) {
+		pthread_join(workers[i].pthread, NULL);
+	}
+	offload_stop();
+	io_stop();
+	sleep_stop();
+	trace_free();
+	stack_fault_stop();
+
+	for (int i = 0; i < nr_workers; i++) {
+		uthread_ctx_destroy_stack(&workers[i].idle->stack);
+		free(workers[i].idle);
 	}
-	uthread_ctx_destroy_stack(curr_thr->stack);
-	free(curr_thr); // main_thr and curr_thr should point to same thing at this point (main thread's tcb struct)
-	num_thr = 0; // reset when stopping uthread library
+	free(workers);
+	workers = NULL;
+	nr_workers = 0;
+	this_worker = NULL;
+	free(main_thr);
+	while ((node = iqueue_dequeue(&dead_thrs)) != NULL)
+		thr_free(iqueue_entry(node, tcb, link));
+	free(thr_table); // reset when stopping uthread library
+	thr_table = NULL;
 
 	return 0;
 }
 
+void uthread_attr_init(uthread_attr_t *attr)
+{
+	attr->stack_size = UTHREAD_STACK_SIZE;
+	attr->stack_max = UTHREAD_STACK_MAX;
+	attr->guard_size = UTHREAD_GUARD_SIZE;
+	attr->priority = UTHREAD_PRIO_DEFAULT;
+	attr->detached = 0;
+}
+
 int uthread_create(uthread_func_t func)
 {
-	preempt_disable();
+	return uthread_create_attr(func, NULL);
+}
+
+int uthread_create_n_attr(uthread_func_t func, void *const *args, int n,
+			  const uthread_attr_t *attr, uthread_t *tids)
+{
+	uthread_attr_t default_attr;
+	struct tcb_block *block;
+	uthread_stack_t *stacks;
+	int i;
+
+	if (attr == NULL) {
+		uthread_attr_init(&default_attr);
+		attr = &default_attr;
+	}
+	if (n <= 0 || tids == NULL) return -1;
+	if (attr->priority < 0 || attr->priority >= UTHREAD_PRIO_LEVELS) return -1;
+
+	block = malloc(sizeof(*block) + n * sizeof(tcb));
+	stacks = malloc(n * sizeof(*stacks));
+	if (block == NULL || stacks == NULL) {
+		free(stacks);
+		free(block);
+		return -1;
+	}
+	atomic_init(&block->nr_live, n);
+
+	uthread_sched_lock();
+	if (uthread_ctx_alloc_stacks(stacks, n, attr->stack_size, attr->stack_max,
+				     attr->guard_size) == -1) {
+		uthread_sched_unlock();
+		free(stacks);
+		free(block);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		tcb_t thr = &block->thrs[i];
+
+		thr->func = func;
+		thr->joining_thr = NULL;
+		thr->home = NULL;
+		thr->base_prio = thr->prio = attr->priority;
+		thr->rq = NULL;
+		thr->arg = args ? args[i] : NULL;
+		thr->block = block;
+		thr->detached = attr->detached;
+		STATS(thr->stats = (struct thr_stats){0});
+		thr->stack = stacks[i];
+		if (uthread_ctx_init(&thr->ctx, &thr->stack, thread_start) == -1
+		    || thr_table_insert(thr) == -1) { // TID space exhausted
+			break;
+		}
+		tids[i] = thr->tid;
+	}
+	if (i < n) { // undo it all
+		for (int j = 0; j < n; j++) {
+			if (j < i) thr_table_remove(&block->thrs[j]);
+			uthread_ctx_destroy_stack(&stacks[j]);
+		}
+		uthread_sched_unlock();
+		free(stacks);
+		free(block);
+		return -1;
+	}
+	make_ready_n(block->thrs, n);
+	STATS(nr_creates += n);
+	for (i = 0; i < n; i++)
+		TRACE(trace_event(this_worker->id, TRACE_CREATE, tids[i], 0));
+	uthread_sched_unlock();
+	free(stacks);
+
+	return 0;
+}
+
+int uthread_create_n(uthread_func_t func, void *const *args, int n, uthread_t *tids)
+{
+	return uthread_create_n_attr(func, args, n, NULL, tids);
+}
+
+void *uthread_arg(void)
+{
+	return uthread_current()->arg;
+}
+
+int uthread_create_attr(uthread_func_t func, const uthread_attr_t *attr)
+{
+	uthread_attr_t default_attr;
 
-	if (num_thr == USHRT_MAX) return -1;
+	if (attr == NULL) {
+		uthread_attr_init(&default_attr);
+		attr = &default_attr;
+	}
+	if (attr->priority < 0 || attr->priority >= UTHREAD_PRIO_LEVELS) return -1;
 
-	tcb_t thr = malloc(sizeof(tcb));
+	tcb_t thr = thr_alloc();
 	if (thr == NULL) return -1;
-	thr->tid = ++num_thr;
-	preempt_enable();
-	thr->state = READY;
-	thr->stack = uthread_ctx_alloc_stack();
-	if (thr->stack == NULL) return -1;
-	thr->joining_thr_tid = thr->tid;
-	if (uthread_ctx_init(&thr->ctx, thr->stack, func) == -1) return -1;
-	if (queue_enqueue(scheduler[READY], thr) == -1) return -1;
+	thr->func = func;
+	thr->joining_thr = NULL;
+	thr->home = NULL;
+	thr->base_prio = thr->prio = attr->priority;
+	thr->rq = NULL;
+	thr->arg = NULL;
+	thr->detached = attr->detached;
+	STATS(thr->stats = (struct thr_stats){0});
+
+	uthread_sched_lock();
+	if (uthread_ctx_alloc_stack(&thr->stack, attr->stack_size, attr->stack_max,
+				    attr->guard_size) == -1
+	    || uthread_ctx_init(&thr->ctx, &thr->stack, thread_start) == -1
+	    || thr_table_insert(thr) == -1) { // TID space exhausted
+		uthread_ctx_destroy_stack(&thr->stack);
+		uthread_sched_unlock();
+		thr_free(thr);
+		return -1;
+	}
+	make_ready(thr);
+	STATS(nr_creates++);
+	TRACE(trace_event(this_worker->id, TRACE_CREATE, thr->tid, 0));
+	uthread_sched_unlock();
 
 	return thr->tid;
 }
 
+/* Poll for I/O readiness once in a while, on behalf of a busy worker */
+static void io_poll_busy(struct worker *w)
+{
+	if (io_waiting() && ++w->io_yields % IO_POLL_INTERVAL == 0) io_poll(0);
+}
+
 void uthread_yield(void)
 {
+	io_poll_busy(this_worker);
 	preempt_disable(); // already yielding so don't force to yield again
 
-	tcb_t prev_thr = curr_thr;
+	// Round-robin put back into ready queue once switched out
+	tcb_t self = this_worker->curr;
+	self->state = READY;
+	self->prio = self->base_prio; // MLFQ boost, giving way willingly
+	schedule(0);
+}
 
-	// Round-robin put back into ready queue if previous thread is not a zombie or blocked
-	// If previous thread is a zombie or blocked, already enqueued into the appropriate queue (in exit and join functions)
-	if (prev_thr->state != ZOMBIE && prev_thr->state != BLOCKED) {
-		prev_thr->state = READY;
-		queue_enqueue(scheduler[READY], prev_thr);
+void uthread_yield_preempted(void)
+{
+	if (this_worker == NULL) return; // signal caught by a foreign kernel thread
+
+	if (io_waiting()) io_poll(0); // only once per time slice
+	preempt_disable();
+	tick_stop(this_worker); // if there is no one to preempt for anymore
+
+	tcb_t self = this_worker->curr;
+	self->state = READY;
+	this_worker->preempting = 1;
+	if (scheduler_mlfq && self->prio < UTHREAD_PRIO_LEVELS - 1) {
+		self->prio++; // MLFQ demotion, the time slice was used up
 	}
+	schedule(0);
+}
 
-	if (queue_dequeue(scheduler[READY], (void**)&curr_thr) == -1) { // if no more threads in ready queue, do nothing and continue
-		return;
+int uthread_set_quantum(unsigned int quantum_us)
+{
+	if (quantum_us == 0 || !scheduler_preempt) return -1;
+
+	return preempt_set_quantum(quantum_us);
+}
+
+void uthread_maybe_yield(void)
+{
+	if (preempt_take_pending()) uthread_yield_preempted();
+}
+
+int uthread_set_priority(uthread_t tid, int priority)
+{
+	if (priority < 0 || priority >= UTHREAD_PRIO_LEVELS) return -1;
+
+	uthread_sched_lock();
+	tcb_t thr = thr_table_lookup(tid);
+	if (thr == NULL || thr->state == ZOMBIE) {
+		uthread_sched_unlock();
+		return -1;
 	}
-	curr_thr->state = RUNNING;
-	uthread_ctx_switch(&prev_thr->ctx, &curr_thr->ctx);
-	preempt_enable();
+
+	thr->base_prio = priority;
+	// Move a ready thread to its new level, unless a worker takes it first
+	struct worker *w;
+	while ((w = thr->rq) != NULL) {
+		runq_lock(w);
+		if (thr->rq == w) {
+			runq_del(w, thr);
+			thr->prio = priority;
+			runq_add(w, thr);
+			runq_unlock(w);
+			break;
+		}
+		runq_unlock(w);
+	}
+	thr->prio = priority;
+	uthread_sched_unlock();
+
+	return 0;
 }
 
 uthread_t uthread_self(void)
 {
-	return curr_thr->tid;
+	return uthread_current()->tid;
 }
 
-void uthread_exit(int retval)
+int uthread_nr_workers(void)
+{
+	return nr_workers;
+}
+
+struct tcb *uthread_current(void)
 {
+	tcb_t self;
+
+	// Once preempted, the thread may resume on another worker: read the
+	// current thread of the worker it is running on right now
 	preempt_disable();
-	
-	curr_thr->state = ZOMBIE;
-	curr_thr->retval = retval;
-	queue_enqueue(scheduler[ZOMBIE], curr_thr);
-	
-	// Find joining thread in blocked queue and move to ready queue (if applicable)
-	tcb_t joining_thr = NULL;
-
-	if (curr_thr->joining_thr_tid != uthread_self()) { // if has calling thread to collect its return value
-		queue_iterate(scheduler[BLOCKED], find_thread, &curr_thr->joining_thr_tid, (void **)&joining_thr);
-		if (joining_thr) { // unblock joining thread and enqueue into ready queue
-			queue_delete(scheduler[BLOCKED], joining_thr);
-			joining_thr->state = READY;
-			queue_enqueue(scheduler[READY], joining_thr);
-		}
+	self = this_worker->curr;
+	preempt_enable();
+
+	return self;
+}
+
+void uthread_block(void)
+{
+	tcb_t self = this_worker->curr;
+
+	self->state = BLOCKED;
+	self->prio = self->base_prio; // MLFQ boost, giving way willingly
+	iqueue_enqueue(&scheduler[BLOCKED], &self->link);
+	schedule(1);
+}
+
+void uthread_wake(struct tcb *thr)
+{
+	TRACE(trace_event(this_worker->id, TRACE_WAKE, thr->tid, 0));
+	iqueue_delete(&scheduler[BLOCKED], &thr->link);
+	make_ready(thr);
+}
+
+void uthread_wake_switch(struct tcb *thr)
+{
+	struct worker *w = this_worker;
+	tcb_t self = w->curr;
+
+	if (thr->prio > self->prio || (thr->home && thr->home != w)) {
+		uthread_wake(thr);
+		uthread_sched_unlock();
+		return;
 	}
+
+	// The current thread gets back into the ready queue once switched out
+	TRACE(trace_event(w->id, TRACE_WAKE, thr->tid, 0));
+	iqueue_delete(&scheduler[BLOCKED], &thr->link);
+	STATS(thr->stats.since = stats_clock()); // it never waits in a ready queue
+	self->state = READY;
+	switch_to(w, thr, 1);
+	finish_switch();
 	preempt_enable();
-	uthread_yield();
+}
+
+void uthread_exit(int retval)
+{
+	uthread_sched_lock();
+
+	tcb_t self = this_worker->curr;
+	self->state = ZOMBIE;
+	self->retval = retval;
+	TRACE(trace_event(this_worker->id, TRACE_EXIT, self->tid, retval));
+	uthread_ctx_stack_record(&self->stack);
+	if (self->detached) {
+		// Nobody collects it: the thread switched to frees its stack and TCB
+		thr_table_remove(self);
+		schedule(1);
+		assert(0);
+	}
+	iqueue_enqueue(&scheduler[ZOMBIE], &self->link);
+	
+	// Unblock joining thread and enqueue into ready queue (if applicable)
+	tcb_t joining_thr = self->joining_thr;
+
+	if (joining_thr && joining_thr->state == BLOCKED) uthread_wake(joining_thr);
+
+	// Zombies are never scheduled again
+	schedule(1);
+	assert(0);
 }
 
 int uthread_join(uthread_t tid, int *retval)
 {
 	if (tid == 0 || tid == uthread_self()) return -1; // main thread and self thread check
 
-	tcb_t target = NULL;
+	uthread_sched_lock();
 
-	// Search for target thread in active queues
-	queue_iterate(scheduler[READY], find_thread, &tid, (void **)&target);
-	if (target == NULL) queue_iterate(scheduler[BLOCKED], find_thread, &tid, (void **)&target); // search blocked queue if target thread not in ready queue
-	
-	if (target) {
-		if (target->joining_thr_tid == target->tid) { // if thread tid not already joined
-			target->joining_thr_tid = uthread_self();
-			curr_thr->state = BLOCKED; // block calling thread
-			queue_enqueue(scheduler[BLOCKED], curr_thr);
-			uthread_yield();
-		} else { // if thread tid already being joined
-			return -1;
-		}
+	tcb_t self = this_worker->curr;
+	tcb_t target = thr_table_lookup(tid);
+
+	// Thread tid cannot be found, is detached or is already being joined
+	if (target == NULL || target->detached || target->joining_thr != NULL) {
+		uthread_sched_unlock();
+		return -1;
 	}
+	target->joining_thr = self;
 
-	// Search for thread tid in zombie queue and collect retval if found
-	// This block also runs when calling thread is unblocked. When calling thread unblocked, target thread should be a zombie.
-	queue_iterate(scheduler[ZOMBIE], find_thread, &tid, (void **)&target);
-	if (target && (target->joining_thr_tid == target->tid || target->joining_thr_tid == uthread_self())) {
-		queue_delete(scheduler[ZOMBIE], target);
-		if (retval != NULL) *retval = target->retval;
-		uthread_ctx_destroy_stack(target->stack);
-		free(target);
-		target = NULL;
+	// Block calling thread until thread tid is a zombie
+	if (target->state != ZOMBIE) {
+		uthread_block();
+		uthread_sched_lock();
+	}
+
+	// Collect retval of zombie thread tid and release it
+	iqueue_delete(&scheduler[ZOMBIE], &target->link);
+	thr_table_remove(target);
+	uthread_ctx_destroy_stack(&target->stack);
+	STATS(nr_joins++);
+	uthread_sched_unlock();
+
+	if (retval != NULL) *retval = target->retval;
+	thr_free(target);
+	target = NULL;
+
+	return 0;
+}
+
+int uthread_detach(uthread_t tid)
+{
+	if (tid == 0) return -1; // the main thread never exits
+
+	uthread_sched_lock();
+	tcb_t target = thr_table_lookup(tid);
+
+	if (target == NULL || target->detached || target->joining_thr != NULL) {
+		uthread_sched_unlock();
+		return -1;
+	}
+	if (target->state != ZOMBIE) { // released by itself once it exits
+		target->detached = 1;
+		uthread_sched_unlock();
 		return 0;
 	}
 
+	// Already exited, collect it right away
+	iqueue_delete(&scheduler[ZOMBIE], &target->link);
+	thr_table_remove(target);
+	uthread_ctx_destroy_stack(&target->stack);
+	uthread_sched_unlock();
+	thr_free(target);
+
+	return 0;
+}
+
+uint64_t stats_ns(uint64_t ticks)
+{
+#if defined(__x86_64__)
+	static double ns_per_tick; // calibrated once against the kernel's clock
+
+	if (ns_per_tick == 0) {
+		struct timespec start, now;
+		uint64_t start_ticks = stats_clock();
+		double ns;
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		do {
+			clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+			ns = (now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec);
+		} while (ns < 1e6);
+		ns_per_tick = ns / (stats_clock() - start_ticks);
+	}
+	return ticks * ns_per_tick;
+#else
+	return ticks;
+#endif
+}
+
+long uthread_stack_usage(uthread_t tid)
+{
+	long used = -1;
+
+	uthread_sched_lock();
+	tcb_t thr = thr_table_lookup(tid);
+	if (thr != NULL) used = uthread_ctx_stack_usage(&thr->stack);
+	uthread_sched_unlock();
+
+	return used;
+}
+
+int uthread_stats_get(uthread_t tid, uthread_stats_t *out)
+{
+#ifdef UTHREAD_STATS
+	struct thr_stats stats;
+	uint64_t now;
+
+	if (out == NULL) return -1;
+
+	uthread_sched_lock();
+	tcb_t thr = thr_table_lookup(tid);
+	if (thr == NULL) {
+		uthread_sched_unlock();
+		return -1;
+	}
+	stats = thr->stats;
+	now = stats_clock();
+	// Account for the current run or wait as well
+	if (thr->state == RUNNING) stats.run += now - stats.since;
+	else if (thr->state == READY) stats.ready += now - stats.since;
+	uthread_sched_unlock();
+
+	out->nr_voluntary = stats.nr_voluntary;
+	out->nr_involuntary = stats.nr_involuntary;
+	out->run_ns = stats_ns(stats.run);
+	out->ready_ns = stats_ns(stats.ready);
+	return 0;
+#else
+	(void)tid;
+	(void)out;
 	return -1;
+#endif
 }
 
+int uthread_stats_global(uthread_global_stats_t *out)
+{
+#ifdef UTHREAD_STATS
+	if (out == NULL) return -1;
+
+	out->nr_ticks_taken = out->nr_ticks_deferred = 0;
+	if (scheduler_preempt) preempt_get_stats(&out->nr_ticks_taken, &out->nr_ticks_deferred);
+	out->max_ready = 0;
+	uthread_sched_lock();
+	out->nr_creates = nr_creates;
+	out->nr_joins = nr_joins;
+	for (int i = 0; i < nr_workers; i++) {
+		runq_lock(&workers[i]);
+		if (workers[i].runq.max_len > out->max_ready) out->max_ready = workers[i].runq.max_len;
+		runq_unlock(&workers[i]);
+	}
+	uthread_sched_unlock();
+	return 0;
+#else
+	(void)out;
+	return -1;
+#endif
+}
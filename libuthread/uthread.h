@@ -1,16 +1,24 @@
 #ifndef _UTHREAD_H
 #define _UTHREAD_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
 /*
  * uthread_t - Thread identifier (TID) type
  *
- * Each user thread is assigned a different TID. TID are assigned in increasing
- * order and numbered starting from 1 (apart from the 'main' thread who
- * automatically gets TID #0). Overflowing the current TID value is considered a
- * case of failure (in other words, it is impossible to create more than
- * USHRT_MAX threads).
+ * Each live user thread is assigned a different TID. The 'main' thread
+ * automatically gets TID #0, and the first threads are numbered in increasing
+ * order starting from 1. A TID is a handle into the library's thread table: it
+ * encodes the index of the thread's slot along with a generation counter. Once
+ * a thread is collected, its slot gets reused by later threads under a new
+ * generation, so that the stale TID never refers to another thread. The number
+ * of threads existing at the same time is limited to about one million.
  */
-typedef unsigned short uthread_t;
+typedef unsigned int uthread_t;
 
 /*
  * uthread_func_t - Thread function type
@@ -19,6 +27,92 @@ typedef unsigned short uthread_t;
  */
 typedef int (*uthread_func_t)(void);
 
+/*
+ * Thread priorities
+ *
+ * Threads have a priority between 0 (highest) and UTHREAD_PRIO_LEVELS - 1
+ * (lowest). The scheduler always runs a ready thread of the highest priority
+ * level available, and round-robins among the threads of a same level, so that
+ * lower priority threads only run when no higher priority thread is ready.
+ */
+#define UTHREAD_PRIO_LEVELS 32
+#define UTHREAD_PRIO_DEFAULT 16
+
+/*
+ * uthread_attr_t - Thread creation attributes
+ * @stack_size: Size of the thread's stack in bytes, rounded up to whole pages
+ * @stack_max: Size in bytes the thread's stack may grow to, rounded up to whole
+ *	pages (0, or @stack_size at most, for a stack which cannot grow)
+ * @guard_size: Size in bytes of the inaccessible region below the thread's
+ *	stack, which makes stack overflows fault (0 for no guard region)
+ * @priority: Priority of the thread, see UTHREAD_PRIO_LEVELS
+ * @detached: Whether the thread starts detached, see uthread_detach()
+ *
+ * Stacks are only reserved when the thread is created and their memory gets
+ * committed as the thread touches it, so that large stacks only cost what is
+ * actually used. Note that every guard region costs a memory mapping of its
+ * own, so creating a very large number of guarded threads may hit the system's
+ * limit on the number of mappings (vm.max_map_count on Linux).
+ *
+ * A growable stack starts at @stack_size and reserves @stack_max: when the
+ * thread goes deeper, the fault is caught and the stack grows, at least
+ * doubling each time, instead of overflowing. This lets threads start with a
+ * page or two of stack while a few of them may go deep. Stacks are growable by
+ * default, and only stacks which never grew are pooled for reuse. Like a guard
+ * region, the part a stack may grow into costs a memory mapping. The library
+ * handles SIGSEGV while it runs, passing on the faults it does not cause to the
+ * previous handler.
+ */
+typedef struct uthread_attr {
+	size_t stack_size;
+	size_t stack_max;
+	size_t guard_size;
+	int priority;
+	int detached;
+} uthread_attr_t;
+
+/*
+ * Preemption modes
+ *
+ * With UTHREAD_PREEMPT_ASYNC, the preemption timer switches the running thread
+ * out wherever it is. With UTHREAD_PREEMPT_POLL, the timer only flags the
+ * running thread, which yields at its next call into the library or at its
+ * next uthread_maybe_yield(), so that threads are never switched out in the
+ * middle of code that is not prepared for it.
+ */
+#define UTHREAD_PREEMPT_NONE 0
+#define UTHREAD_PREEMPT_ASYNC 1
+#define UTHREAD_PREEMPT_POLL 2
+
+/*
+ * uthread_opts_t - Library options
+ * @preempt: Preemption mode, see UTHREAD_PREEMPT_ASYNC
+ * @nr_workers: Number of kernel threads running the user threads, 0 for one
+ *	per online CPU
+ * @mlfq: Multi-level feedback queue enable: a thread which gets preempted
+ *	drops one priority level, and gets its own priority back as soon as it
+ *	yields or blocks, which favors interactive threads over CPU hogs
+ * @quantum_us: Preemption time slice in microseconds
+ * @clock: Clock measuring the time slices: CLOCK_THREAD_CPUTIME_ID to count
+ *	the CPU time used by each kernel thread, or CLOCK_MONOTONIC to count
+ *	elapsed time (which also runs while the kernel thread is descheduled)
+ *
+ * With more than one worker, the library runs in M:N mode: user threads are
+ * multiplexed over @nr_workers kernel threads, each with its own ready queue,
+ * and idle workers steal ready threads from busy ones. The 'main' thread always
+ * runs on the process' original kernel thread.
+ */
+typedef struct uthread_opts {
+	int preempt;
+	int nr_workers;
+	int mlfq;
+	unsigned int quantum_us;
+	clockid_t clock;
+} uthread_opts_t;
+
+/* Default preemption time slice, in microseconds */
+#define UTHREAD_QUANTUM_DEFAULT 10000
+
 /*
  * uthread_start - Start the multithreading library
  * @preempt: Preemption enable
@@ -26,19 +120,41 @@ typedef int (*uthread_func_t)(void);
  * This function should only be called by the process' original execution
  * thread. It starts the multithreading scheduling library, and registers the
  * calling thread as the 'main' user-level thread (TID 0). If @preempt is
- * `true`, then preemptive scheduling is enabled.
+ * `true`, then preemptive scheduling is enabled (@preempt can also be one of
+ * the preemption modes, see UTHREAD_PREEMPT_ASYNC).
  *
  * Return: 0 in case of success, -1 in case of failure (e.g., memory
  * allocation).
  */
 int uthread_start(int preempt);
 
+/*
+ * uthread_opts_init - Initialize library options
+ * @opts: Options to initialize
+ *
+ * Set @opts to the defaults used by uthread_start(): no preemption, a single
+ * worker, static priorities and time slices of UTHREAD_QUANTUM_DEFAULT of CPU
+ * time.
+ */
+void uthread_opts_init(uthread_opts_t *opts);
+
+/*
+ * uthread_start_opts - Start the multithreading library with options
+ * @opts: Options, as initialized by uthread_opts_init() and then customized
+ *
+ * This function behaves like uthread_start(), but configures the library
+ * according to @opts. In M:N mode, the additional workers are launched here.
+ *
+ * Return: 0 in case of success, -1 in case of failure.
+ */
+int uthread_start_opts(const uthread_opts_t *opts);
+
 /*
  * uthread_stop - Stop the multithreading library
  *
  * This function should only be called by the main execution thread of the
  * process. It stops the multithreading scheduling library if there are no more
- * user threads.
+ * user threads, waiting for the additional workers of the M:N mode to finish.
  *
  * Return: 0 in case of success, -1 in case of failure.
  */
@@ -51,11 +167,80 @@ int uthread_stop(void);
  * This function creates a new thread running the function @func and returns the
  * TID of this new thread.
  *
- * Return: -1 in case of failure (memory allocation, context creation, TID
- * overflow, etc.), or the TID of the new thread.
+ * Return: -1 in case of failure (memory allocation, context creation, too
+ * many live threads, etc.), or the TID of the new thread.
  */
 int uthread_create(uthread_func_t func);
 
+/*
+ * uthread_attr_init - Initialize thread creation attributes
+ * @attr: Attributes to initialize
+ *
+ * Set @attr to the default attributes used by uthread_create(): a 32 KiB stack
+ * which may grow up to 1 MiB, with a one page guard region, and the
+ * UTHREAD_PRIO_DEFAULT priority.
+ */
+void uthread_attr_init(uthread_attr_t *attr);
+
+/*
+ * uthread_create_attr - Create a new thread with specific attributes
+ * @func: Function to be executed by the thread
+ * @attr: Attributes of the new thread, or NULL for the default ones
+ *
+ * This function behaves like uthread_create(), but creates the new thread with
+ * the attributes @attr, as initialized by uthread_attr_init() and then
+ * customized.
+ *
+ * Return: -1 in case of failure, or the TID of the new thread.
+ */
+int uthread_create_attr(uthread_func_t func, const uthread_attr_t *attr);
+
+/*
+ * uthread_create_n - Create many threads at once
+ * @func: Function to be executed by every thread
+ * @args: Array of @n arguments, one per thread, which each thread gets with
+ *	uthread_arg(), or NULL
+ * @n: Number of threads to create
+ * @tids: Array where to store the TIDs of the @n new threads
+ *
+ * This function behaves like @n calls to uthread_create(), but allocates all
+ * the control blocks in one block and the stacks in one region, and makes the
+ * threads ready to run in one go. The threads are spread over the workers in
+ * M:N mode.
+ *
+ * Return: -1 in case of failure, in which case no thread was created. 0
+ * otherwise.
+ */
+int uthread_create_n(uthread_func_t func, void *const *args, int n, uthread_t *tids);
+
+/*
+ * uthread_create_n_attr - Create many threads at once with specific attributes
+ * @func: Function to be executed by every thread
+ * @args: Array of @n arguments, one per thread, or NULL
+ * @n: Number of threads to create
+ * @attr: Attributes of the new threads, or NULL for the default ones
+ * @tids: Array where to store the TIDs of the @n new threads
+ *
+ * This function behaves like uthread_create_n(), but creates the new threads
+ * with the attributes @attr. With a guard region or room to grow, each stack
+ * costs the process two memory mappings, which caps the number of threads (see
+ * /proc/sys/vm/max_map_count): set @attr->guard_size and @attr->stack_max to 0
+ * for more threads.
+ *
+ * Return: -1 in case of failure, in which case no thread was created. 0
+ * otherwise.
+ */
+int uthread_create_n_attr(uthread_func_t func, void *const *args, int n,
+			  const uthread_attr_t *attr, uthread_t *tids);
+
+/*
+ * uthread_arg - Get the argument of the current thread
+ *
+ * Return: The argument the calling thread was given by uthread_create_n(), or
+ * NULL if it was created by another function
+ */
+void *uthread_arg(void);
+
 /*
  * uthread_self - Get thread identifier
  *
@@ -71,6 +256,16 @@ uthread_t uthread_self(void);
  */
 void uthread_yield(void);
 
+/*
+ * uthread_maybe_yield - Yield if the time slice is over
+ *
+ * Preemption point for long computations: yield if the preemption timer fired
+ * since the calling thread was last scheduled, or return right away, without
+ * any system call, otherwise. This is how threads get preempted in the
+ * UTHREAD_PREEMPT_POLL mode.
+ */
+void uthread_maybe_yield(void);
+
 /*
  * uthread_exit - Exit from currently running thread
  * @retval: Return value
@@ -99,9 +294,568 @@ void uthread_exit(int retval);
  * A thread can be joined by only one other thread.
  *
  * Return: -1 if @tid is 0 (the 'main' thread cannot be joined), if @tid is the
- * TID of the calling thread, if thread @tid cannot be found, or if thread @tid
- * is already being joined. 0 otherwise.
+ * TID of the calling thread, if thread @tid cannot be found, is detached, or is
+ * already being joined. 0 otherwise.
  */
 int uthread_join(uthread_t tid, int *retval);
 
+/*
+ * uthread_detach - Detach a thread
+ * @tid: TID of the thread to detach
+ *
+ * A detached thread cannot be joined: its resources are released as soon as it
+ * exits instead of it staying a zombie, and its return value is lost. If thread
+ * @tid already exited, it is collected right away.
+ *
+ * Return: -1 if @tid is 0, if thread @tid cannot be found, is already detached,
+ * or is being joined. 0 otherwise.
+ */
+int uthread_detach(uthread_t tid);
+
+/*
+ * uthread_set_priority - Set the priority of a thread
+ * @tid: TID of the thread
+ * @priority: New priority, between 0 (highest) and UTHREAD_PRIO_LEVELS - 1
+ *
+ * A ready thread is immediately moved to the ready queue of its new priority.
+ * The running thread keeps running until it yields or gets preempted.
+ *
+ * Return: -1 if @priority is out of range, or if thread @tid cannot be found or
+ * has already exited. 0 otherwise.
+ */
+int uthread_set_priority(uthread_t tid, int priority);
+
+/*
+ * uthread_set_quantum - Change the preemption time slice
+ * @quantum_us: New time slice in microseconds
+ *
+ * Return: -1 if @quantum_us is 0 or if preemption is not enabled. 0 otherwise.
+ */
+int uthread_set_quantum(unsigned int quantum_us);
+
+/*
+ * uthread_set_stack_cache - Set the number of cached thread stacks
+ * @nr_stacks: Number of stacks to keep committed
+ *
+ * Stacks of collected threads are kept around to be reused by future threads.
+ * Up to @nr_stacks of them keep their memory committed, which makes creating
+ * threads cheaper; the memory of any additional idle stack is returned to the
+ * system. The default is 1024 stacks.
+ */
+void uthread_set_stack_cache(unsigned int nr_stacks);
+
+/*
+ * uthread_sleep_ns - Sleep for a while
+ * @ns: Duration of the sleep, in nanoseconds
+ *
+ * Block the calling thread for at least @ns nanoseconds, while other threads
+ * keep running. When no thread is ready, the process blocks until the nearest
+ * deadline. Sleeps end on ticks of about 65 microseconds.
+ *
+ * Return: 0 once the sleep is over
+ */
+int uthread_sleep_ns(uint64_t ns);
+
+/*
+ * uthread_sleep_until - Sleep until an absolute deadline
+ * @deadline: Time of CLOCK_MONOTONIC at which to wake up
+ *
+ * Like uthread_sleep_ns(), but returns right away if @deadline is over.
+ *
+ * Return: 0 once @deadline is over, or -1 if @deadline is not a valid time
+ */
+int uthread_sleep_until(const struct timespec *deadline);
+
+/*
+ * Synchronization
+ *
+ * Mutexes, condition variables and semaphores block the threads which have to
+ * wait for them, each object keeping its waiters in FIFO order. Releasing an
+ * object hands it over directly to its oldest waiter. Uncontended operations
+ * only cost an atomic instruction.
+ */
+
+/* Default number of attempts to take a mutex before blocking, in M:N mode */
+#define UTHREAD_MUTEX_SPIN 100
+
+typedef struct uthread_mutex *uthread_mutex_t;
+typedef struct uthread_cond *uthread_cond_t;
+typedef struct uthread_sem *uthread_sem_t;
+
+/*
+ * uthread_mutex_create - Allocate an unlocked mutex
+ *
+ * Return: Pointer to new mutex, or NULL in case of memory allocation failure
+ */
+uthread_mutex_t uthread_mutex_create(void);
+
+/*
+ * uthread_mutex_destroy - Deallocate a mutex
+ * @mutex: Mutex to deallocate
+ *
+ * Return: -1 if @mutex is NULL or locked. 0 otherwise.
+ */
+int uthread_mutex_destroy(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_set_spin - Set how long to spin before blocking
+ * @mutex: Mutex to configure
+ * @spin: Number of attempts to take @mutex before blocking, 0 to block right
+ *	away
+ *
+ * In M:N mode, the owner of a mutex may be running on another worker and about
+ * to unlock it, so a locking thread first spins for a little while. Spinning
+ * is useless with a single worker, and never happens then.
+ *
+ * Return: -1 if @mutex is NULL. 0 otherwise.
+ */
+int uthread_mutex_set_spin(uthread_mutex_t mutex, unsigned int spin);
+
+/*
+ * uthread_mutex_lock - Lock a mutex
+ * @mutex: Mutex to lock
+ *
+ * Block the calling thread until it owns @mutex.
+ *
+ * Return: -1 if @mutex is NULL or already owned by the calling thread. 0
+ * otherwise.
+ */
+int uthread_mutex_lock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_trylock - Lock a mutex if it is unlocked
+ * @mutex: Mutex to lock
+ *
+ * Return: -1 if @mutex is NULL or locked. 0 if the calling thread now owns it.
+ */
+int uthread_mutex_trylock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_unlock - Unlock a mutex
+ * @mutex: Mutex to unlock
+ *
+ * If threads wait for @mutex, the oldest one becomes its owner.
+ *
+ * Return: -1 if @mutex is NULL or not owned by the calling thread. 0 otherwise.
+ */
+int uthread_mutex_unlock(uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_create - Allocate a condition variable
+ *
+ * Return: Pointer to new condition variable, or NULL in case of memory
+ * allocation failure
+ */
+uthread_cond_t uthread_cond_create(void);
+
+/*
+ * uthread_cond_destroy - Deallocate a condition variable
+ * @cond: Condition variable to deallocate
+ *
+ * Return: -1 if @cond is NULL or if threads wait on it. 0 otherwise.
+ */
+int uthread_cond_destroy(uthread_cond_t cond);
+
+/*
+ * uthread_cond_wait - Wait on a condition variable
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex owned by the calling thread
+ *
+ * Atomically unlock @mutex and block until @cond is signaled. The calling
+ * thread owns @mutex again when this returns.
+ *
+ * Return: -1 if @cond or @mutex are NULL, or if @mutex is not owned by the
+ * calling thread. 0 otherwise.
+ */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_signal - Wake up the oldest thread waiting on a condition variable
+ * @cond: Condition variable to signal
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_signal(uthread_cond_t cond);
+
+/*
+ * uthread_cond_broadcast - Wake up all the threads waiting on a condition variable
+ * @cond: Condition variable to signal
+ *
+ * The threads get to own their mutex, and thus run, one at a time.
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_broadcast(uthread_cond_t cond);
+
+/*
+ * uthread_sem_create - Allocate a semaphore
+ * @count: Initial number of units
+ *
+ * Return: Pointer to new semaphore, or NULL in case of memory allocation
+ * failure
+ */
+uthread_sem_t uthread_sem_create(unsigned int count);
+
+/*
+ * uthread_sem_destroy - Deallocate a semaphore
+ * @sem: Semaphore to deallocate
+ *
+ * Return: -1 if @sem is NULL or if threads wait on it. 0 otherwise.
+ */
+int uthread_sem_destroy(uthread_sem_t sem);
+
+/*
+ * uthread_sem_down - Take a unit from a semaphore
+ * @sem: Semaphore to take a unit from
+ *
+ * Block the calling thread until a unit is available.
+ *
+ * Return: -1 if @sem is NULL. 0 otherwise.
+ */
+int uthread_sem_down(uthread_sem_t sem);
+
+/*
+ * uthread_sem_up - Give a unit to a semaphore
+ * @sem: Semaphore to give a unit to
+ *
+ * If threads wait for @sem, the unit goes to the oldest one.
+ *
+ * Return: -1 if @sem is NULL. 0 otherwise.
+ */
+int uthread_sem_up(uthread_sem_t sem);
+
+/*
+ * Channels
+ *
+ * A channel carries elements of a fixed size from sending threads to receiving
+ * threads, in FIFO order. A buffered channel holds up to its capacity of sent
+ * elements which were not received yet, while an unbuffered channel (of
+ * capacity 0) makes every sender wait for a receiver. Threads block while a
+ * channel cannot serve them, and elements are copied directly between a
+ * blocked thread and its counterpart.
+ */
+
+/* Maximum number of operations of uthread_chan_select() */
+#define UTHREAD_CHAN_SELECT_MAX 64
+
+#define UTHREAD_CHAN_SEND 0
+#define UTHREAD_CHAN_RECV 1
+
+typedef struct uthread_chan *uthread_chan_t;
+
+/*
+ * struct uthread_chan_op - Channel operation of uthread_chan_select()
+ * @chan: Channel to operate on, NULL for an operation which never completes
+ * @dir: UTHREAD_CHAN_SEND or UTHREAD_CHAN_RECV
+ * @elem: Element to send, or buffer to receive an element into
+ * @ok: Set once the operation completed, to 1 if an element was sent or
+ *	received, 0 if the channel was closed
+ */
+struct uthread_chan_op {
+	uthread_chan_t chan;
+	int dir;
+	void *elem;
+	int ok;
+};
+
+/*
+ * uthread_chan_create - Allocate a channel
+ * @elem_size: Size in bytes of the elements
+ * @capacity: Number of elements the channel can buffer, 0 for an unbuffered
+ *	channel
+ *
+ * Return: Pointer to new channel, or NULL if @elem_size is 0 or in case of
+ * memory allocation failure
+ */
+uthread_chan_t uthread_chan_create(size_t elem_size, size_t capacity);
+
+/*
+ * uthread_chan_destroy - Deallocate a channel
+ * @chan: Channel to deallocate
+ *
+ * Elements still buffered are lost.
+ *
+ * Return: -1 if @chan is NULL or if threads wait on it. 0 otherwise.
+ */
+int uthread_chan_destroy(uthread_chan_t chan);
+
+/*
+ * uthread_chan_send - Send an element through a channel
+ * @chan: Channel to send through
+ * @elem: Address of the element to send
+ *
+ * Block the calling thread until the element is buffered by @chan or handed to
+ * a receiver. On an unbuffered channel, a receiver which was waiting for it
+ * runs right away.
+ *
+ * Return: -1 if @chan or @elem are NULL, or if @chan is closed (possibly while
+ * waiting, in which case the element is not sent). 0 otherwise.
+ */
+int uthread_chan_send(uthread_chan_t chan, const void *elem);
+
+/*
+ * uthread_chan_recv - Receive an element from a channel
+ * @chan: Channel to receive from
+ * @elem: Address to copy the element to
+ *
+ * Block the calling thread until an element is available.
+ *
+ * Return: -1 if @chan or @elem are NULL, or if @chan is closed and has no more
+ * elements. 0 otherwise.
+ */
+int uthread_chan_recv(uthread_chan_t chan, void *elem);
+
+/*
+ * uthread_chan_close - Close a channel
+ * @chan: Channel to close
+ *
+ * No element can be sent through @chan anymore. Receivers still get the
+ * elements buffered by @chan, and then fail to receive. Threads waiting on
+ * @chan are woken up and fail.
+ *
+ * Return: -1 if @chan is NULL or already closed. 0 otherwise.
+ */
+int uthread_chan_close(uthread_chan_t chan);
+
+/*
+ * uthread_chan_select - Complete one of several channel operations
+ * @ops: Array of operations
+ * @nr_ops: Number of operations in @ops, up to UTHREAD_CHAN_SELECT_MAX
+ * @block: Whether to block until an operation can complete
+ *
+ * Complete exactly one of the operations which can complete right away, picked
+ * in turn among them, and set its @ok field. If none can and @block is set,
+ * block the calling thread until one of them completes. An operation on a
+ * closed channel completes with @ok set to 0.
+ *
+ * Return: Index of the completed operation. -1 if @ops is invalid or has no
+ * channel at all, or if @block is not set and no operation could complete.
+ */
+int uthread_chan_select(struct uthread_chan_op *ops, int nr_ops, int block);
+
+/*
+ * Non-blocking I/O
+ *
+ * The following functions behave like their system call counterparts, except
+ * that when the operation would block, only the calling thread blocks until the
+ * file descriptor gets ready, while other threads keep running. They are meant
+ * for sockets, pipes and other pollable file descriptors opened in non-blocking
+ * mode (O_NONBLOCK or SOCK_NONBLOCK). Such a descriptor must be closed with
+ * uthread_close().
+ *
+ * At most one thread at a time can wait to read from (or accept on) a given
+ * descriptor, and one to write to (or connect) it, otherwise -1 is returned
+ * with errno set to EBUSY.
+ */
+
+/*
+ * uthread_read - Read from a file descriptor
+ *
+ * Return: Number of bytes read, 0 at the end of file, or -1 with errno set
+ */
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/*
+ * uthread_write - Write to a file descriptor
+ *
+ * Return: Number of bytes written, or -1 with errno set
+ */
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/*
+ * uthread_accept - Accept a connection on a listening socket
+ *
+ * The accepted socket is in non-blocking mode and close-on-exec.
+ *
+ * Return: File descriptor of the accepted socket, or -1 with errno set
+ */
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+
+/*
+ * uthread_connect - Connect a socket
+ *
+ * Return: 0 once connected, or -1 with errno set
+ */
+int uthread_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * uthread_close - Close a file descriptor
+ *
+ * Threads still blocked on @fd are woken up, and see their operation fail.
+ *
+ * Return: 0 in case of success, or -1 with errno set
+ */
+int uthread_close(int fd);
+
+/*
+ * uthread_offload_func_t - Function run by a helper kernel thread
+ * @arg: Argument passed to uthread_offload()
+ */
+typedef void *(*uthread_offload_func_t)(void *arg);
+
+/*
+ * uthread_offload - Run a blocking call without blocking other threads
+ * @func: Function to run
+ * @arg: Argument of @func
+ *
+ * This is meant for calls that cannot be made non-blocking, such as reading
+ * regular files, fsync(), stat() or getaddrinfo(). @func runs on a helper
+ * kernel thread from a small pool while the calling thread is blocked and
+ * other threads keep running. @func must not call any uthread function.
+ * If no helper can be started, @func runs on the calling thread.
+ *
+ * Return: Value returned by @func, with errno set as @func left it
+ */
+void *uthread_offload(uthread_offload_func_t func, void *arg);
+
+/*
+ * Statistics
+ *
+ * With the library built with statistics (`make STATS=1`), the scheduler keeps
+ * counters per thread and for the whole library, for as long as the library
+ * runs. Without it (the default), they do not exist at all and cost nothing.
+ */
+
+/*
+ * uthread_stats_t - Statistics of a thread
+ * @nr_voluntary: Number of times the thread was switched out as it yielded,
+ *	blocked or exited
+ * @nr_involuntary: Number of times it was switched out as it got preempted
+ * @run_ns: Time spent running, in nanoseconds
+ * @ready_ns: Time spent in a ready queue waiting to run, in nanoseconds
+ */
+typedef struct uthread_stats {
+	unsigned long nr_voluntary;
+	unsigned long nr_involuntary;
+	uint64_t run_ns;
+	uint64_t ready_ns;
+} uthread_stats_t;
+
+/*
+ * uthread_global_stats_t - Statistics of the library since it was started
+ * @nr_creates: Number of threads created
+ * @nr_joins: Number of threads collected by uthread_join()
+ * @nr_ticks_taken: Number of preemption ticks which made the running thread
+ *	yield right away
+ * @nr_ticks_deferred: Number of preemption ticks which were deferred to the
+ *	end of a critical section of the library, or to the next preemption
+ *	point in the UTHREAD_PREEMPT_POLL mode
+ * @max_ready: Highest number of threads found in a worker's ready queue
+ */
+typedef struct uthread_global_stats {
+	unsigned long nr_creates;
+	unsigned long nr_joins;
+	unsigned long nr_ticks_taken;
+	unsigned long nr_ticks_deferred;
+	unsigned long max_ready;
+} uthread_global_stats_t;
+
+/*
+ * uthread_stats_get - Get the statistics of a thread
+ * @tid: TID of the thread, which may have exited but not been collected yet
+ * @out: Where to store the statistics
+ *
+ * Return: -1 if the library was built without statistics, if @out is NULL, or
+ * if thread @tid cannot be found. 0 otherwise.
+ */
+int uthread_stats_get(uthread_t tid, uthread_stats_t *out);
+
+/*
+ * uthread_stats_global - Get the statistics of the library
+ * @out: Where to store the statistics
+ *
+ * Return: -1 if the library was built without statistics, or if @out is NULL.
+ * 0 otherwise.
+ */
+int uthread_stats_global(uthread_global_stats_t *out);
+
+/*
+ * Tracing
+ *
+ * While tracing is on, the scheduler records its events: thread creations,
+ * context switches along with the reason why the thread switched out did so
+ * (yield, preemption, blocking or exit), wakeups of blocked threads, and
+ * thread exits. Each worker records into a fixed-size ring buffer of its own,
+ * without allocating nor locking, which keeps the most recent events only.
+ */
+
+/*
+ * uthread_trace_start - Start tracing
+ * @nr_events: Number of events kept per worker, rounded up to a power of 2
+ *
+ * The events of a previous trace are discarded. Its buffers are reused if they
+ * have the same size, and otherwise only freed when the library stops, as a
+ * worker may still be finishing its last record.
+ *
+ * Return: -1 if the library is not running, if @nr_events is 0, if tracing is
+ * already on, or in case of memory allocation failure. 0 otherwise.
+ */
+int uthread_trace_start(size_t nr_events);
+
+/*
+ * uthread_trace_stop - Stop tracing
+ *
+ * The events recorded so far are kept until the next trace starts or the
+ * library stops.
+ */
+void uthread_trace_stop(void);
+
+/*
+ * uthread_trace_dump - Write the trace to a file
+ * @path: Path of the file to write
+ *
+ * Write the events recorded by the last trace in the Chrome trace event JSON
+ * format, which timeline viewers such as Perfetto (https://ui.perfetto.dev)
+ * or chrome://tracing open. Every worker gets a track, on which a slice shows
+ * a thread running, and ends with the reason why it was switched out.
+ *
+ * Return: -1 if tracing is on, if there is no trace, or if the file cannot be
+ * written. 0 otherwise.
+ */
+int uthread_trace_dump(const char *path);
+
+/*
+ * Stack usage
+ *
+ * To find out how large thread stacks need to be, stacks can be painted with
+ * a known pattern when allocated: the deepest byte overwritten since then is
+ * the high-water mark of the thread's stack. Painting touches every page of
+ * the stacks, so it is meant for sizing stacks rather than for production.
+ */
+
+/* Number of buckets of the stack usage histogram */
+#define UTHREAD_STACK_HIST_BUCKETS 16
+
+/*
+ * uthread_set_stack_paint - Turn stack painting on or off
+ * @enable: Whether to paint the stacks of the threads created from now on
+ *
+ * Turning painting on also clears the stack usage histogram. Threads created
+ * while painting was off never have their stack usage measured.
+ */
+void uthread_set_stack_paint(int enable);
+
+/*
+ * uthread_stack_usage - Get the stack high-water mark of a thread
+ * @tid: TID of the thread, which may have exited but not been collected yet
+ *
+ * Return: Number of bytes of its stack that thread @tid used at most so far,
+ * or -1 if the thread cannot be found or its stack was not painted (as for the
+ * main thread, which runs on the process' stack).
+ */
+long uthread_stack_usage(uthread_t tid);
+
+/*
+ * uthread_stack_histogram - Get the histogram of stack usage
+ * @hist: Where to store the histogram
+ *
+ * Every thread with a painted stack is counted in the histogram when it exits:
+ * @hist[0] counts the threads which used up to 1 KiB of stack, and each bucket
+ * @hist[i] the threads which used up to 1 KiB << @i and more than the previous
+ * bucket, the last bucket counting all the threads which used more.
+ *
+ * Return: -1 if @hist is NULL. 0 otherwise.
+ */
+int uthread_stack_histogram(unsigned long hist[UTHREAD_STACK_HIST_BUCKETS]);
+
 #endif /* _THREAD_H */
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "iqueue.h"
+#include "wheel.h"
+
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+
+struct wheel {
+	uint64_t now; // last tick processed
+	int length;
+	uint64_t occupied[WHEEL_LEVELS]; // bit i is set if slot i is not empty
+	struct iqueue slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/* Shift giving the slot index of a time at level @level */
+static inline int level_shift(int level)
+{
+	return level * WHEEL_SLOT_BITS;
+}
+
+/*
+ * Link @timer into the slot where it belongs when expiring at @expires, which
+ * must not be before the current time. A timer expiring right now goes into
+ * the current slot of level 0, which is only valid while the current tick is
+ * being processed.
+ */
+static void wheel_insert(wheel_t wheel, struct wheel_timer *timer, uint64_t expires)
+{
+	uint64_t delta;
+	int level = 0;
+
+	if (expires < wheel->now) expires = wheel->now;
+	if (expires - wheel->now >= WHEEL_RANGE) expires = wheel->now + WHEEL_RANGE - 1;
+	delta = expires - wheel->now;
+
+	// A slot at level l spans WHEEL_SLOTS^l ticks
+	while (level < WHEEL_LEVELS - 1 && delta >> level_shift(level + 1))
+		level++;
+
+	timer->level = level;
+	timer->slot = (expires >> level_shift(level)) & SLOT_MASK;
+	iqueue_enqueue(&wheel->slots[level][timer->slot], &timer->link);
+	wheel->occupied[level] |= (uint64_t)1 << timer->slot;
+}
+
+/* Unlink @timer from its slot */
+static void wheel_unlink(wheel_t wheel, struct wheel_timer *timer)
+{
+	struct iqueue *slot = &wheel->slots[timer->level][timer->slot];
+
+	iqueue_delete(slot, &timer->link);
+	if (iqueue_length(slot) == 0) {
+		wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+	}
+	timer->level = -1;
+}
+
+wheel_t wheel_create(uint64_t now)
+{
+	wheel_t wheel = malloc(sizeof(struct wheel));
+
+	if (wheel == NULL) return NULL;
+	wheel->now = now;
+	wheel->length = 0;
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		wheel->occupied[level] = 0;
+		for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+			iqueue_init(&wheel->slots[level][slot]);
+		}
+	}
+
+	return wheel;
+}
+
+int wheel_destroy(wheel_t wheel)
+{
+	if (wheel == NULL || wheel->length) return -1;
+
+	free(wheel);
+	return 0;
+}
+
+int wheel_add(wheel_t wheel, struct wheel_timer *timer, uint64_t expires)
+{
+	if (wheel == NULL || timer == NULL) return -1;
+
+	// The current tick was processed already
+	timer->expires = expires;
+	wheel_insert(wheel, timer, expires > wheel->now ? expires : wheel->now + 1);
+	wheel->length++;
+
+	return 0;
+}
+
+int wheel_del(wheel_t wheel, struct wheel_timer *timer)
+{
+	if (wheel == NULL || timer == NULL || timer->level < 0) return -1;
+
+	wheel_unlink(wheel, timer);
+	wheel->length--;
+
+	return 0;
+}
+
+uint64_t wheel_next(wheel_t wheel)
+{
+	uint64_t next = WHEEL_NEVER;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t occupied = wheel->occupied[level];
+		uint64_t period = wheel->now >> level_shift(level);
+		int from, ahead;
+
+		if (occupied == 0) continue;
+
+		// Slots are processed at the start of their period, look for the
+		// first occupied one after the current period's
+		from = (period + 1) & SLOT_MASK;
+		if (from) occupied = (occupied >> from) | (occupied << (WHEEL_SLOTS - from));
+		ahead = __builtin_ctzll(occupied) + 1;
+
+		uint64_t start = (period + ahead) << level_shift(level);
+		if (start < next) next = start;
+	}
+
+	return next;
+}
+
+int wheel_advance(wheel_t wheel, uint64_t now, struct iqueue *expired)
+{
+	int nr_expired = 0;
+
+	if (wheel == NULL || expired == NULL) return -1;
+
+	while (wheel->now < now) {
+		uint64_t next = wheel_next(wheel);
+		struct iqueue_node *node;
+		struct iqueue *slot;
+
+		if (next > now) { // nothing to do in between
+			wheel->now = now;
+			break;
+		}
+		wheel->now = next;
+
+		// Cascade the coarse slots starting at this tick, coarsest first so
+		// that their timers can keep cascading down
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+			int index = (next >> level_shift(level)) & SLOT_MASK;
+
+			if (next & (((uint64_t)1 << level_shift(level)) - 1)) continue;
+			if (!(wheel->occupied[level] & ((uint64_t)1 << index))) continue;
+
+			slot = &wheel->slots[level][index];
+			while ((node = iqueue_dequeue(slot)) != NULL) {
+				struct wheel_timer *timer = iqueue_entry(node, struct wheel_timer, link);
+				wheel_insert(wheel, timer, timer->expires);
+			}
+			wheel->occupied[level] &= ~((uint64_t)1 << index);
+		}
+
+		// Expire the timers of this tick
+		slot = &wheel->slots[0][next & SLOT_MASK];
+		while ((node = iqueue_dequeue(slot)) != NULL) {
+			struct wheel_timer *timer = iqueue_entry(node, struct wheel_timer, link);
+
+			timer->level = -1;
+			iqueue_enqueue(expired, &timer->link);
+			wheel->length--;
+			nr_expired++;
+		}
+		wheel->occupied[0] &= ~((uint64_t)1 << (next & SLOT_MASK));
+	}
+
+	return nr_expired;
+}
+
+int wheel_length(wheel_t wheel)
+{
+	if (wheel == NULL) return -1;
+
+	return wheel->length;
+}
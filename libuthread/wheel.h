@@ -0,0 +1,123 @@
+#ifndef _WHEEL_H
+#define _WHEEL_H
+
+/*
+ * This header is only meant to be included by files from the libuthread, and
+ * by their testers.
+ */
+
+#include <stdint.h>
+
+#include "iqueue.h"
+
+/*
+ * wheel_t - Hierarchical timing wheel type
+ *
+ * A timing wheel keeps timers sorted by expiration time, in abstract ticks. It
+ * has WHEEL_LEVELS levels of WHEEL_SLOTS slots each: level 0 holds the timers
+ * expiring within WHEEL_SLOTS ticks, one slot per tick, and every level above
+ * covers a range WHEEL_SLOTS times as long with slots as many times coarser.
+ * When time reaches a coarse slot, its timers cascade down to finer levels.
+ *
+ * Adding and deleting a timer are O(1). Advancing the wheel costs O(1) per
+ * expired or cascaded timer, empty slots being skipped with a bitmap per level.
+ */
+typedef struct wheel* wheel_t;
+
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_LEVELS 6
+
+/* Span of the coarsest level, in ticks */
+#define WHEEL_RANGE ((uint64_t)1 << (WHEEL_SLOT_BITS * WHEEL_LEVELS))
+
+/* Returned by wheel_next() for an empty wheel */
+#define WHEEL_NEVER UINT64_MAX
+
+/*
+ * struct wheel_timer - Timer
+ * @expires: Expiration time, in ticks
+ *
+ * To be embedded in the structure of the objects waiting for a timeout, like
+ * struct iqueue_node. A timer is in at most one wheel at a time.
+ */
+struct wheel_timer {
+	uint64_t expires;
+	int level; // level of the slot holding the timer, -1 if not in a wheel
+	int slot; // index of that slot within its level
+	struct iqueue_node link;
+};
+
+/*
+ * wheel_create - Allocate an empty timing wheel
+ * @now: Current time, in ticks
+ *
+ * Return: Pointer to new empty wheel. NULL in case of failure when allocating
+ * the new wheel.
+ */
+wheel_t wheel_create(uint64_t now);
+
+/*
+ * wheel_destroy - Deallocate a timing wheel
+ * @wheel: Wheel to deallocate
+ *
+ * Return: -1 if @wheel is NULL or if timers are still pending. 0 if @wheel was
+ * successfully destroyed.
+ */
+int wheel_destroy(wheel_t wheel);
+
+/*
+ * wheel_add - Add a timer
+ * @wheel: Wheel in which to add the timer
+ * @timer: Timer to add, which must not be in a wheel already
+ * @expires: Expiration time, in ticks
+ *
+ * A timer expiring at or before the current time of @wheel expires at the next
+ * tick. A timer expiring more than WHEEL_RANGE ticks away waits in the coarsest
+ * level, where it keeps cascading back until it gets within range.
+ *
+ * Return: -1 if @wheel or @timer are NULL. 0 if @timer was successfully added.
+ */
+int wheel_add(wheel_t wheel, struct wheel_timer *timer, uint64_t expires);
+
+/*
+ * wheel_del - Delete a timer before it expires
+ * @wheel: Wheel holding the timer
+ * @timer: Timer to delete, which was added to @wheel at some point
+ *
+ * Return: -1 if @wheel or @timer are NULL, or if @timer is not in @wheel anymore
+ * (it expired or was deleted already). 0 if @timer was successfully deleted.
+ */
+int wheel_del(wheel_t wheel, struct wheel_timer *timer);
+
+/*
+ * wheel_next - Time of the next wheel event
+ * @wheel: Wheel to look into
+ *
+ * Return the earliest time at which advancing @wheel has something to do:
+ * either a timer expires, or timers cascade to a finer level. Advancing @wheel
+ * any earlier cannot expire any timer.
+ *
+ * Return: Time of the next event in ticks, or WHEEL_NEVER if @wheel is empty
+ */
+uint64_t wheel_next(wheel_t wheel);
+
+/*
+ * wheel_advance - Advance the current time of a timing wheel
+ * @wheel: Wheel to advance
+ * @now: New current time, in ticks
+ * @expired: Queue where the expired timers get enqueued, in expiration order
+ *
+ * Return: Number of timers that expired, or -1 if @wheel or @expired are NULL
+ */
+int wheel_advance(wheel_t wheel, uint64_t now, struct iqueue *expired);
+
+/*
+ * wheel_length - Number of pending timers
+ * @wheel: Wheel to get the length of
+ *
+ * Return: Number of timers in @wheel, or -1 if @wheel is NULL
+ */
+int wheel_length(wheel_t wheel);
+
+#endif /* _WHEEL_H */